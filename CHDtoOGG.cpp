@@ -32,10 +32,71 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#define CHDTOOGG_VERSION "1.2"
 
 #define WASM_RT_FROM_INVOKER
 #include "EncodeVorbis.wasm-rt.h"
 
+#ifndef _WIN32 // Parallel encoding with forked worker processes is only available on POSIX systems
+#define CHDTOOGG_WORKERS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <utime.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <sys/ioctl.h>
+#include <linux/futex.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+// Hashing uses CPU extensions where available, selected at runtime on x86 and ARM
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CHDTOOGG_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHDTOOGG_TARGET(x)
+#else
+#include <cpuid.h>
+#define CHDTOOGG_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define CHDTOOGG_ARM
+#include <arm_acle.h>
+#include <arm_neon.h>
+#define CHDTOOGG_TARGET(x) __attribute__((target(x)))
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 typedef unsigned char Bit8u;
 typedef unsigned short Bit16u;
 typedef signed short Bit16s;
@@ -62,120 +123,306 @@ typedef unsigned long long Bit64u;
 #define CHD_READ_BE32(p) ((Bit32u)((((const Bit8u *)(p))[0] << 24) | (((const Bit8u *)(p))[1] << 16) | (((const Bit8u *)(p))[2] << 8) | ((const Bit8u *)(p))[3]))
 #define CHD_READ_BE64(p) ((Bit64u)((((Bit64u)((const Bit8u *)(p))[0] << 56) | ((Bit64u)((const Bit8u *)(p))[1] << 48) | ((Bit64u)((const Bit8u *)(p))[2] << 40) | ((Bit64u)((const Bit8u *)(p))[3] << 32) | ((Bit64u)((const Bit8u *)(p))[4] << 24) | ((Bit64u)((const Bit8u *)(p))[5] << 16) | ((Bit64u)((const Bit8u *)(p))[6] << 8) | (Bit64u)((const Bit8u *)(p))[7])))
 
-static Bit32u CRC32(const void *data, size_t data_size)
+#ifdef CHDTOOGG_X86
+static void CPUID(Bit32u leaf, Bit32u sub, Bit32u regs[4])
+{
+	#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)sub);
+	#else
+	__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+	#endif
+}
+
+static Bit64u XGETBV0()
+{
+	#ifdef _MSC_VER
+	return _xgetbv(0);
+	#else
+	Bit32u eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((Bit64u)edx << 32) | eax;
+	#endif
+}
+#endif
+
+#ifdef CHDTOOGG_ARM
+// Extensions as reported by the Linux kernel, elsewhere only those enabled at compile time
+enum { ARM_CRC32 = 1, ARM_PMULL = 2, ARM_SHA1 = 4 };
+static Bit32u ARMFeatures()
+{
+	#ifdef __linux__
+	unsigned long hwcap = getauxval(AT_HWCAP);
+	return ((hwcap & HWCAP_CRC32) ? ARM_CRC32 : 0) | ((hwcap & HWCAP_PMULL) ? ARM_PMULL : 0) | ((hwcap & HWCAP_SHA1) ? ARM_SHA1 : 0);
+	#else
+	Bit32u features = 0;
+	#ifdef __ARM_FEATURE_CRC32
+	features |= ARM_CRC32;
+	#endif
+	#if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+	features |= ARM_PMULL;
+	#endif
+	#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+	features |= ARM_SHA1;
+	#endif
+	return features;
+	#endif
+}
+#endif
+
+struct CRC32Impl
 {
-	static const Bit32u tbl[256] = { 0,0x77073096,0xEE0E612C,0x990951BA,0x76DC419,0x706AF48F,0xE963A535,0x9E6495A3,0xEDB8832,0x79DCB8A4,0xE0D5E91E,0x97D2D988,0x9B64C2B,0x7EB17CBD,0xE7B82D07,0x90BF1D91,0x1DB71064,0x6AB020F2,0xF3B97148,0x84BE41DE,0x1ADAD47D,0x6DDDE4EB,0xF4D4B551,0x83D385C7,0x136C9856,0x646BA8C0,0xFD62F97A,0x8A65C9EC,0x14015C4F,0x63066CD9,0xFA0F3D63,0x8D080DF5,0x3B6E20C8,0x4C69105E,0xD56041E4,0xA2677172,0x3C03E4D1,0x4B04D447,0xD20D85FD,0xA50AB56B,0x35B5A8FA,0x42B2986C,0xDBBBC9D6,0xACBCF940,0x32D86CE3,0x45DF5C75,0xDCD60DCF,0xABD13D59,0x26D930AC,0x51DE003A,0xC8D75180,0xBFD06116,0x21B4F4B5,0x56B3C423,0xCFBA9599,0xB8BDA50F,0x2802B89E,0x5F058808,0xC60CD9B2,0xB10BE924,0x2F6F7C87,0x58684C11,0xC1611DAB,0xB6662D3D,0x76DC4190,0x1DB7106,0x98D220BC,0xEFD5102A,0x71B18589,0x6B6B51F,0x9FBFE4A5,0xE8B8D433,0x7807C9A2,0xF00F934,0x9609A88E,0xE10E9818,0x7F6A0DBB,0x86D3D2D,0x91646C97,0xE6635C01,0x6B6B51F4,0x1C6C6162,0x856530D8,0xF262004E,0x6C0695ED,0x1B01A57B,0x8208F4C1,0xF50FC457,0x65B0D9C6,0x12B7E950,0x8BBEB8EA,0xFCB9887C,0x62DD1DDF,0x15DA2D49,0x8CD37CF3,0xFBD44C65,0x4DB26158,0x3AB551CE,0xA3BC0074,0xD4BB30E2,0x4ADFA541,0x3DD895D7,0xA4D1C46D,0xD3D6F4FB,0x4369E96A,0x346ED9FC,0xAD678846,0xDA60B8D0,0x44042D73,0x33031DE5,0xAA0A4C5F,0xDD0D7CC9,0x5005713C,0x270241AA,0xBE0B1010,0xC90C2086,0x5768B525,0x206F85B3,0xB966D409,0xCE61E49F,0x5EDEF90E,0x29D9C998,0xB0D09822,0xC7D7A8B4,0x59B33D17,0x2EB40D81,0xB7BD5C3B,0xC0BA6CAD,
+	// Slice-by-16 tables where tbl[k][i] is the CRC of byte i followed by k zero bytes
+	Bit32u tbl[16][256];
+	Bit32u (*Update)(const CRC32Impl& impl, Bit32u crc, const Bit8u* p, size_t len);
+
+	CRC32Impl()
+	{
+		static const Bit32u tbl0[256] = { 0,0x77073096,0xEE0E612C,0x990951BA,0x76DC419,0x706AF48F,0xE963A535,0x9E6495A3,0xEDB8832,0x79DCB8A4,0xE0D5E91E,0x97D2D988,0x9B64C2B,0x7EB17CBD,0xE7B82D07,0x90BF1D91,0x1DB71064,0x6AB020F2,0xF3B97148,0x84BE41DE,0x1ADAD47D,0x6DDDE4EB,0xF4D4B551,0x83D385C7,0x136C9856,0x646BA8C0,0xFD62F97A,0x8A65C9EC,0x14015C4F,0x63066CD9,0xFA0F3D63,0x8D080DF5,0x3B6E20C8,0x4C69105E,0xD56041E4,0xA2677172,0x3C03E4D1,0x4B04D447,0xD20D85FD,0xA50AB56B,0x35B5A8FA,0x42B2986C,0xDBBBC9D6,0xACBCF940,0x32D86CE3,0x45DF5C75,0xDCD60DCF,0xABD13D59,0x26D930AC,0x51DE003A,0xC8D75180,0xBFD06116,0x21B4F4B5,0x56B3C423,0xCFBA9599,0xB8BDA50F,0x2802B89E,0x5F058808,0xC60CD9B2,0xB10BE924,0x2F6F7C87,0x58684C11,0xC1611DAB,0xB6662D3D,0x76DC4190,0x1DB7106,0x98D220BC,0xEFD5102A,0x71B18589,0x6B6B51F,0x9FBFE4A5,0xE8B8D433,0x7807C9A2,0xF00F934,0x9609A88E,0xE10E9818,0x7F6A0DBB,0x86D3D2D,0x91646C97,0xE6635C01,0x6B6B51F4,0x1C6C6162,0x856530D8,0xF262004E,0x6C0695ED,0x1B01A57B,0x8208F4C1,0xF50FC457,0x65B0D9C6,0x12B7E950,0x8BBEB8EA,0xFCB9887C,0x62DD1DDF,0x15DA2D49,0x8CD37CF3,0xFBD44C65,0x4DB26158,0x3AB551CE,0xA3BC0074,0xD4BB30E2,0x4ADFA541,0x3DD895D7,0xA4D1C46D,0xD3D6F4FB,0x4369E96A,0x346ED9FC,0xAD678846,0xDA60B8D0,0x44042D73,0x33031DE5,0xAA0A4C5F,0xDD0D7CC9,0x5005713C,0x270241AA,0xBE0B1010,0xC90C2086,0x5768B525,0x206F85B3,0xB966D409,0xCE61E49F,0x5EDEF90E,0x29D9C998,0xB0D09822,0xC7D7A8B4,0x59B33D17,0x2EB40D81,0xB7BD5C3B,0xC0BA6CAD,
 		0xEDB88320,0x9ABFB3B6,0x3B6E20C,0x74B1D29A,0xEAD54739,0x9DD277AF,0x4DB2615,0x73DC1683,0xE3630B12,0x94643B84,0xD6D6A3E,0x7A6A5AA8,0xE40ECF0B,0x9309FF9D,0xA00AE27,0x7D079EB1,0xF00F9344,0x8708A3D2,0x1E01F268,0x6906C2FE,0xF762575D,0x806567CB,0x196C3671,0x6E6B06E7,0xFED41B76,0x89D32BE0,0x10DA7A5A,0x67DD4ACC,0xF9B9DF6F,0x8EBEEFF9,0x17B7BE43,0x60B08ED5,0xD6D6A3E8,0xA1D1937E,0x38D8C2C4,0x4FDFF252,0xD1BB67F1,0xA6BC5767,0x3FB506DD,0x48B2364B,0xD80D2BDA,0xAF0A1B4C,0x36034AF6,0x41047A60,0xDF60EFC3,0xA867DF55,0x316E8EEF,0x4669BE79,0xCB61B38C,0xBC66831A,0x256FD2A0,0x5268E236,0xCC0C7795,0xBB0B4703,0x220216B9,0x5505262F,0xC5BA3BBE,0xB2BD0B28,0x2BB45A92,0x5CB36A04,0xC2D7FFA7,0xB5D0CF31,0x2CD99E8B,0x5BDEAE1D,0x9B64C2B0,0xEC63F226,0x756AA39C,0x26D930A,0x9C0906A9,0xEB0E363F,0x72076785,0x5005713,0x95BF4A82,0xE2B87A14,0x7BB12BAE,0xCB61B38,0x92D28E9B,0xE5D5BE0D,0x7CDCEFB7,0xBDBDF21,0x86D3D2D4,0xF1D4E242,0x68DDB3F8,0x1FDA836E,0x81BE16CD,0xF6B9265B,0x6FB077E1,0x18B74777,0x88085AE6,0xFF0F6A70,0x66063BCA,0x11010B5C,0x8F659EFF,0xF862AE69,0x616BFFD3,0x166CCF45,0xA00AE278,0xD70DD2EE,0x4E048354,0x3903B3C2,0xA7672661,0xD06016F7,0x4969474D,0x3E6E77DB,0xAED16A4A,0xD9D65ADC,0x40DF0B66,0x37D83BF0,0xA9BCAE53,0xDEBB9EC5,0x47B2CF7F,0x30B5FFE9,0xBDBDF21C,0xCABAC28A,0x53B39330,0x24B4A3A6,0xBAD03605,0xCDD70693,0x54DE5729,0x23D967BF,0xB3667A2E,0xC4614AB8,0x5D681B02,0x2A6F2B94,0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D };
-	Bit32u crc = (Bit32u)~(Bit32u)0;
-	Bit8u* p = (Bit8u*)data, *pEnd = p + data_size;
-	for (; data_size & 3; data_size--) crc = (crc >> 8) ^ tbl[(crc ^ *(p++)) & 0xFF];
-	for (; p != pEnd; p+=4)
+		memcpy(tbl[0], tbl0, sizeof(tbl0));
+		for (int k = 1; k != 16; k++)
+			for (int i = 0; i != 256; i++)
+				tbl[k][i] = (tbl[k - 1][i] >> 8) ^ tbl[0][tbl[k - 1][i] & 0xFF];
+
+		Update = UpdateTable;
+		#ifdef CHDTOOGG_X86
+		Bit32u regs[4];
+		CPUID(0, 0, regs);
+		if (regs[0] >= 1) { CPUID(1, 0, regs); if ((regs[2] & (1 << 1)) && (regs[3] & (1 << 26))) Update = UpdatePCLMUL; } // PCLMULQDQ and SSE2
+		#elif defined(CHDTOOGG_ARM)
+		Bit32u features = ARMFeatures();
+		if (features & ARM_CRC32) Update = ((features & ARM_PMULL) ? UpdatePMULL : UpdateARM);
+		#endif
+	}
+
+	static Bit32u UpdateTable(const CRC32Impl& impl, Bit32u crc, const Bit8u* p, size_t len)
+	{
+		const Bit32u (*tbl)[256] = impl.tbl;
+		for (; len >= 16; p += 16, len -= 16)
+		{
+			Bit32u a = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((Bit32u)p[3] << 24));
+			crc = tbl[15][a & 0xFF] ^ tbl[14][(a >> 8) & 0xFF] ^ tbl[13][(a >> 16) & 0xFF] ^ tbl[12][a >> 24]
+				^ tbl[11][p[4]] ^ tbl[10][p[5]] ^ tbl[9][p[6]] ^ tbl[8][p[7]] ^ tbl[7][p[8]] ^ tbl[6][p[9]] ^ tbl[5][p[10]] ^ tbl[4][p[11]]
+				^ tbl[3][p[12]] ^ tbl[2][p[13]] ^ tbl[1][p[14]] ^ tbl[0][p[15]];
+		}
+		for (; len; len--) crc = (crc >> 8) ^ tbl[0][(crc ^ *(p++)) & 0xFF];
+		return crc;
+	}
+
+	#ifdef CHDTOOGG_X86
+	// Folding with carry-less multiplication as described in "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" by Intel
+	CHDTOOGG_TARGET("pclmul,sse2") static Bit32u UpdatePCLMUL(const CRC32Impl& impl, Bit32u crc, const Bit8u* p, size_t len)
+	{
+		if (len < 64) return UpdateTable(impl, crc, p, len);
+		const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL), k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+		const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL), poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL), mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+		__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0x00)), x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+		__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 0x20)), x4 = _mm_loadu_si128((const __m128i*)(p + 0x30)), t;
+		x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+		for (p += 64, len -= 64; len >= 64; p += 64, len -= 64)
+		{
+			#define CRC32FOLD(x, k, y) (t = _mm_clmulepi64_si128(x, k, 0x00), x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), t), y))
+			CRC32FOLD(x1, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x00)));
+			CRC32FOLD(x2, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x10)));
+			CRC32FOLD(x3, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x20)));
+			CRC32FOLD(x4, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x30)));
+		}
+		CRC32FOLD(x1, k3k4, x2);
+		CRC32FOLD(x1, k3k4, x3);
+		CRC32FOLD(x1, k3k4, x4);
+		for (; len >= 16; p += 16, len -= 16) CRC32FOLD(x1, k3k4, _mm_loadu_si128((const __m128i*)p));
+		#undef CRC32FOLD
+
+		// Fold 128 to 64 bits then Barrett reduce to 32 bits
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), _mm_srli_si128(x1, 4));
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+		crc = (Bit32u)_mm_cvtsi128_si32(_mm_srli_si128(_mm_xor_si128(x1, x2), 4));
+		return (len ? UpdateTable(impl, crc, p, len) : crc);
+	}
+	#endif
+
+	#ifdef CHDTOOGG_ARM
+	CHDTOOGG_TARGET("+crc") static Bit32u UpdateARM(const CRC32Impl& impl, Bit32u crc, const Bit8u* p, size_t len)
+	{
+		for (; len && ((size_t)p & 7); len--) crc = __crc32b(crc, *(p++));
+		for (; len >= 8; p += 8, len -= 8) crc = __crc32d(crc, *(const Bit64u*)p);
+		for (; len; len--) crc = __crc32b(crc, *(p++));
+		return crc;
+	}
+
+	// The same folding as UpdatePCLMUL with PMULL, the remainder is done with the CRC32 instructions
+	CHDTOOGG_TARGET("+crc+crypto") static Bit32u UpdatePMULL(const CRC32Impl& impl, Bit32u crc, const Bit8u* p, size_t len)
 	{
-		crc = (crc >> 8) ^ tbl[(crc ^ p[0]) & 0xFF];
-		crc = (crc >> 8) ^ tbl[(crc ^ p[1]) & 0xFF];
-		crc = (crc >> 8) ^ tbl[(crc ^ p[2]) & 0xFF];
-		crc = (crc >> 8) ^ tbl[(crc ^ p[3]) & 0xFF];
+		if (len < 64) return UpdateARM(impl, crc, p, len);
+		#define CRC32CLMUL(a, b) vreinterpretq_u64_p128(vmull_p64((poly64_t)(a), (poly64_t)(b)))
+		const uint64x2_t k1k2 = vcombine_u64(vcreate_u64(0x0154442bd4ULL), vcreate_u64(0x01c6e41596ULL));
+		const uint64x2_t k3k4 = vcombine_u64(vcreate_u64(0x01751997d0ULL), vcreate_u64(0x00ccaa009eULL));
+		uint64x2_t x1 = vld1q_u64((const uint64_t*)(p + 0x00)), x2 = vld1q_u64((const uint64_t*)(p + 0x10));
+		uint64x2_t x3 = vld1q_u64((const uint64_t*)(p + 0x20)), x4 = vld1q_u64((const uint64_t*)(p + 0x30));
+		x1 = veorq_u64(x1, vcombine_u64(vcreate_u64(crc), vcreate_u64(0)));
+		for (p += 64, len -= 64; len >= 64; p += 64, len -= 64)
+		{
+			#define CRC32FOLD(x, k, y) (x = veorq_u64(veorq_u64(CRC32CLMUL(vgetq_lane_u64(x, 0), vgetq_lane_u64(k, 0)), CRC32CLMUL(vgetq_lane_u64(x, 1), vgetq_lane_u64(k, 1))), y))
+			CRC32FOLD(x1, k1k2, vld1q_u64((const uint64_t*)(p + 0x00)));
+			CRC32FOLD(x2, k1k2, vld1q_u64((const uint64_t*)(p + 0x10)));
+			CRC32FOLD(x3, k1k2, vld1q_u64((const uint64_t*)(p + 0x20)));
+			CRC32FOLD(x4, k1k2, vld1q_u64((const uint64_t*)(p + 0x30)));
+		}
+		CRC32FOLD(x1, k3k4, x2);
+		CRC32FOLD(x1, k3k4, x3);
+		CRC32FOLD(x1, k3k4, x4);
+		for (; len >= 16; p += 16, len -= 16) CRC32FOLD(x1, k3k4, vld1q_u64((const uint64_t*)p));
+		#undef CRC32FOLD
+
+		// Fold 128 to 64 bits then Barrett reduce to 32 bits, past the first step all products fit in 64 bits
+		uint64x2_t t = CRC32CLMUL(vgetq_lane_u64(x1, 0), vgetq_lane_u64(k3k4, 1));
+		Bit64u lo = vgetq_lane_u64(x1, 1) ^ vgetq_lane_u64(t, 0), hi = vgetq_lane_u64(t, 1);
+		lo = vgetq_lane_u64(CRC32CLMUL(lo & 0xFFFFFFFF, 0x0163cd6124ULL), 0) ^ (lo >> 32) ^ (hi << 32);
+		Bit64u r = vgetq_lane_u64(CRC32CLMUL(lo & 0xFFFFFFFF, 0x01f7011641ULL), 0);
+		r = vgetq_lane_u64(CRC32CLMUL(r & 0xFFFFFFFF, 0x01db710641ULL), 0);
+		#undef CRC32CLMUL
+		crc = (Bit32u)((lo ^ r) >> 32);
+		return (len ? UpdateARM(impl, crc, p, len) : crc);
 	}
-	return ~crc;
+	#endif
+};
+
+// Standard CRC32, pass the result of a previous call as crc to continue it with more data
+static Bit32u CRC32(const void *data, size_t data_size, Bit32u crc = 0)
+{
+	static const CRC32Impl impl;
+	return ~impl.Update(impl, ~crc, (const Bit8u*)data, data_size);
+}
+
+// Multiply two polynomials modulo the CRC32 polynomial (bit reflected, the highest bit is x^0)
+static Bit32u CRC32MultModP(Bit32u a, Bit32u b)
+{
+	Bit32u p = 0;
+	for (Bit32u m = 0x80000000; m; m >>= 1, b = (b >> 1) ^ ((b & 1) ? 0xEDB88320 : 0))
+		if (a & m) p ^= b;
+	return p;
+}
+
+// x^(8*n) modulo the CRC32 polynomial by multiplying the needed powers x^(8*2^k)
+static Bit32u CRC32XPow8N(Bit64u n)
+{
+	Bit32u p = 0x80000000, x2k = 0x00800000;
+	for (; n; n >>= 1, x2k = CRC32MultModP(x2k, x2k))
+		if (n & 1) p = CRC32MultModP(x2k, p);
+	return p;
+}
+
+// CRC32 continued over n zero bytes without reading them
+static Bit32u CRC32Zeros(Bit32u crc, Bit64u n)
+{
+	return ~CRC32MultModP(CRC32XPow8N(n), ~crc);
 }
 
-static void FastMD5(const void* data, size_t data_size, Bit8u res[16])
+// CRC32 of data A followed by data B from the separate CRCs of both
+static Bit32u CRC32Combine(Bit32u crcA, Bit32u crcB, Bit64u lenB)
 {
-	// BASED ON MD5 (public domain)
-	// By Galen Guyer - https://github.com/galenguyer/md5
-	struct MD5_CTX
+	return CRC32MultModP(CRC32XPow8N(lenB), crcA) ^ crcB;
+}
+
+// CRC stored in Ogg page headers (polynomial 0x04c11db7 without bit reflection)
+static Bit32u OggCRC32(const Bit8u* data, size_t data_size)
+{
+	static Bit32u tbl[256];
+	if (!tbl[1]) for (Bit32u i = 0, r; i != 256; tbl[i++] = r) { r = i << 24; for (int j = 0; j != 8; j++) r = (r << 1) ^ ((r & 0x80000000) ? 0x04c11db7 : 0); }
+	Bit32u crc = 0;
+	for (const Bit8u* pEnd = data + data_size; data != pEnd; data++) crc = (crc << 8) ^ tbl[(crc >> 24) ^ *data];
+	return crc;
+}
+
+// BASED ON MD5 (public domain)
+// By Galen Guyer - https://github.com/galenguyer/md5
+struct MD5_CTX
+{
+	Bit32u A, B, C, D;
+	const void* Body(const void *data, size_t size)
 	{
-		Bit32u A, B, C, D;
-		const void* Body(const void *data, size_t size)
+		const Bit8u *ptr = (const Bit8u*)data;
+		Bit32u a = A, b = B, c = C, d = D;
+		do
 		{
-			const Bit8u *ptr = (const Bit8u*)data;
-			Bit32u a = A, b = B, c = C, d = D;
-			do
-			{
-				Bit32u saved_a = a, saved_b = b, saved_c = c, saved_d = d;
-				#define STEP(f, a, b, c, d, x, t, s) (a) += f((b), (c), (d)) + (x) + (t); (a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); (a) += (b);
-				#if defined(__i386__) || _M_IX86 || defined(__x86_64__) || _M_AMD64 || defined(__vax__)
-				#define SET(n) (*(Bit32u *)&ptr[(n) * 4])
-				#define GET(n) SET(n)
-				#else
-				Bit32u block[16];
-				#define SET(n) (block[(n)] = (Bit32u)ptr[(n) * 4] | ((Bit32u)ptr[(n) * 4 + 1] << 8) | ((Bit32u)ptr[(n) * 4 + 2] << 16) | ((Bit32u)ptr[(n) * 4 + 3] << 24))
-				#define GET(n) (block[(n)])
-				#endif
-				#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
-				#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
-				#define H(x, y, z) (((x) ^ (y)) ^ (z))
-				#define J(x, y, z) ((x) ^ ((y) ^ (z)))
-				#define I(x, y, z) ((y) ^ ((x) | ~(z)))
-				STEP(F, a, b, c, d, SET( 0), 0xd76aa478,  7) STEP(F, d, a, b, c, SET( 1), 0xe8c7b756, 12) STEP(F, c, d, a, b, SET( 2), 0x242070db, 17) STEP(F, b, c, d, a, SET( 3), 0xc1bdceee, 22)
-				STEP(F, a, b, c, d, SET( 4), 0xf57c0faf,  7) STEP(F, d, a, b, c, SET( 5), 0x4787c62a, 12) STEP(F, c, d, a, b, SET( 6), 0xa8304613, 17) STEP(F, b, c, d, a, SET( 7), 0xfd469501, 22)
-				STEP(F, a, b, c, d, SET( 8), 0x698098d8,  7) STEP(F, d, a, b, c, SET( 9), 0x8b44f7af, 12) STEP(F, c, d, a, b, SET(10), 0xffff5bb1, 17) STEP(F, b, c, d, a, SET(11), 0x895cd7be, 22)
-				STEP(F, a, b, c, d, SET(12), 0x6b901122,  7) STEP(F, d, a, b, c, SET(13), 0xfd987193, 12) STEP(F, c, d, a, b, SET(14), 0xa679438e, 17) STEP(F, b, c, d, a, SET(15), 0x49b40821, 22)
-				STEP(G, a, b, c, d, GET( 1), 0xf61e2562,  5) STEP(G, d, a, b, c, GET( 6), 0xc040b340,  9) STEP(G, c, d, a, b, GET(11), 0x265e5a51, 14) STEP(G, b, c, d, a, GET( 0), 0xe9b6c7aa, 20)
-				STEP(G, a, b, c, d, GET( 5), 0xd62f105d,  5) STEP(G, d, a, b, c, GET(10), 0x02441453,  9) STEP(G, c, d, a, b, GET(15), 0xd8a1e681, 14) STEP(G, b, c, d, a, GET( 4), 0xe7d3fbc8, 20)
-				STEP(G, a, b, c, d, GET( 9), 0x21e1cde6,  5) STEP(G, d, a, b, c, GET(14), 0xc33707d6,  9) STEP(G, c, d, a, b, GET( 3), 0xf4d50d87, 14) STEP(G, b, c, d, a, GET( 8), 0x455a14ed, 20)
-				STEP(G, a, b, c, d, GET(13), 0xa9e3e905,  5) STEP(G, d, a, b, c, GET( 2), 0xfcefa3f8,  9) STEP(G, c, d, a, b, GET( 7), 0x676f02d9, 14) STEP(G, b, c, d, a, GET(12), 0x8d2a4c8a, 20)
-				STEP(H, a, b, c, d, GET( 5), 0xfffa3942,  4) STEP(J, d, a, b, c, GET( 8), 0x8771f681, 11) STEP(H, c, d, a, b, GET(11), 0x6d9d6122, 16) STEP(J, b, c, d, a, GET(14), 0xfde5380c, 23)
-				STEP(H, a, b, c, d, GET( 1), 0xa4beea44,  4) STEP(J, d, a, b, c, GET( 4), 0x4bdecfa9, 11) STEP(H, c, d, a, b, GET( 7), 0xf6bb4b60, 16) STEP(J, b, c, d, a, GET(10), 0xbebfbc70, 23)
-				STEP(H, a, b, c, d, GET(13), 0x289b7ec6,  4) STEP(J, d, a, b, c, GET( 0), 0xeaa127fa, 11) STEP(H, c, d, a, b, GET( 3), 0xd4ef3085, 16) STEP(J, b, c, d, a, GET( 6), 0x04881d05, 23)
-				STEP(H, a, b, c, d, GET( 9), 0xd9d4d039,  4) STEP(J, d, a, b, c, GET(12), 0xe6db99e5, 11) STEP(H, c, d, a, b, GET(15), 0x1fa27cf8, 16) STEP(J, b, c, d, a, GET( 2), 0xc4ac5665, 23)
-				STEP(I, a, b, c, d, GET( 0), 0xf4292244,  6) STEP(I, d, a, b, c, GET( 7), 0x432aff97, 10) STEP(I, c, d, a, b, GET(14), 0xab9423a7, 15) STEP(I, b, c, d, a, GET( 5), 0xfc93a039, 21)
-				STEP(I, a, b, c, d, GET(12), 0x655b59c3,  6) STEP(I, d, a, b, c, GET( 3), 0x8f0ccc92, 10) STEP(I, c, d, a, b, GET(10), 0xffeff47d, 15) STEP(I, b, c, d, a, GET( 1), 0x85845dd1, 21)
-				STEP(I, a, b, c, d, GET( 8), 0x6fa87e4f,  6) STEP(I, d, a, b, c, GET(15), 0xfe2ce6e0, 10) STEP(I, c, d, a, b, GET( 6), 0xa3014314, 15) STEP(I, b, c, d, a, GET(13), 0x4e0811a1, 21)
-				STEP(I, a, b, c, d, GET( 4), 0xf7537e82,  6) STEP(I, d, a, b, c, GET(11), 0xbd3af235, 10) STEP(I, c, d, a, b, GET( 2), 0x2ad7d2bb, 15) STEP(I, b, c, d, a, GET( 9), 0xeb86d391, 21)
-				#undef F
-				#undef G
-				#undef H
-				#undef J
-				#undef I
-				#undef GET
-				#undef SET
-				#undef STEP
-				a += saved_a; b += saved_b; c += saved_c; d += saved_d; ptr += 64;
-			} while (size -= 64);
-			A = a; B = b; C = c; D = d;
-			return ptr;
-		}
-	} ctx = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
-	size_t ctx_lo = (data_size & 0x1fffffff) << 3, ctx_hi = data_size >> 29;
-	if (data_size >= 64)
-	{
-		data = ctx.Body(data, data_size & ~(unsigned long)63);
-		data_size &= 63;
-	}
-	Bit8u ctx_buffer[64];
-	memcpy(ctx_buffer, data, data_size);
-	ctx_buffer[data_size++] = 0x80;
-	size_t available = 64 - data_size;
-	if (available < 8)
-	{
-		memset(&ctx_buffer[data_size], 0, available);
-		ctx.Body(ctx_buffer, 64);
-		data_size = 0;
-		available = 64;
-	}
-	memset(&ctx_buffer[data_size], 0, available - 8);
-	#define OUT(dst, src) (dst)[0] = (Bit8u)(src); (dst)[1] = (Bit8u)((src) >> 8); (dst)[2] = (Bit8u)((src) >> 16); (dst)[3] = (Bit8u)((src) >> 24);
-	OUT(&ctx_buffer[56], ctx_lo)
-	OUT(&ctx_buffer[60], ctx_hi)
-	ctx.Body(ctx_buffer, 64);
-	OUT(&res[0], ctx.A)
-	OUT(&res[4], ctx.B)
-	OUT(&res[8], ctx.C)
-	OUT(&res[12], ctx.D)
-	#undef OUT
-}
+			Bit32u saved_a = a, saved_b = b, saved_c = c, saved_d = d;
+			#define STEP(f, a, b, c, d, x, t, s) (a) += f((b), (c), (d)) + (x) + (t); (a) = (((a) << (s)) | (((a) & 0xffffffff) >> (32 - (s)))); (a) += (b);
+			#if defined(__i386__) || _M_IX86 || defined(__x86_64__) || _M_AMD64 || defined(__vax__)
+			#define SET(n) (*(Bit32u *)&ptr[(n) * 4])
+			#define GET(n) SET(n)
+			#else
+			Bit32u block[16];
+			#define SET(n) (block[(n)] = (Bit32u)ptr[(n) * 4] | ((Bit32u)ptr[(n) * 4 + 1] << 8) | ((Bit32u)ptr[(n) * 4 + 2] << 16) | ((Bit32u)ptr[(n) * 4 + 3] << 24))
+			#define GET(n) (block[(n)])
+			#endif
+			#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+			#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+			#define H(x, y, z) (((x) ^ (y)) ^ (z))
+			#define J(x, y, z) ((x) ^ ((y) ^ (z)))
+			#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+			STEP(F, a, b, c, d, SET( 0), 0xd76aa478,  7) STEP(F, d, a, b, c, SET( 1), 0xe8c7b756, 12) STEP(F, c, d, a, b, SET( 2), 0x242070db, 17) STEP(F, b, c, d, a, SET( 3), 0xc1bdceee, 22)
+			STEP(F, a, b, c, d, SET( 4), 0xf57c0faf,  7) STEP(F, d, a, b, c, SET( 5), 0x4787c62a, 12) STEP(F, c, d, a, b, SET( 6), 0xa8304613, 17) STEP(F, b, c, d, a, SET( 7), 0xfd469501, 22)
+			STEP(F, a, b, c, d, SET( 8), 0x698098d8,  7) STEP(F, d, a, b, c, SET( 9), 0x8b44f7af, 12) STEP(F, c, d, a, b, SET(10), 0xffff5bb1, 17) STEP(F, b, c, d, a, SET(11), 0x895cd7be, 22)
+			STEP(F, a, b, c, d, SET(12), 0x6b901122,  7) STEP(F, d, a, b, c, SET(13), 0xfd987193, 12) STEP(F, c, d, a, b, SET(14), 0xa679438e, 17) STEP(F, b, c, d, a, SET(15), 0x49b40821, 22)
+			STEP(G, a, b, c, d, GET( 1), 0xf61e2562,  5) STEP(G, d, a, b, c, GET( 6), 0xc040b340,  9) STEP(G, c, d, a, b, GET(11), 0x265e5a51, 14) STEP(G, b, c, d, a, GET( 0), 0xe9b6c7aa, 20)
+			STEP(G, a, b, c, d, GET( 5), 0xd62f105d,  5) STEP(G, d, a, b, c, GET(10), 0x02441453,  9) STEP(G, c, d, a, b, GET(15), 0xd8a1e681, 14) STEP(G, b, c, d, a, GET( 4), 0xe7d3fbc8, 20)
+			STEP(G, a, b, c, d, GET( 9), 0x21e1cde6,  5) STEP(G, d, a, b, c, GET(14), 0xc33707d6,  9) STEP(G, c, d, a, b, GET( 3), 0xf4d50d87, 14) STEP(G, b, c, d, a, GET( 8), 0x455a14ed, 20)
+			STEP(G, a, b, c, d, GET(13), 0xa9e3e905,  5) STEP(G, d, a, b, c, GET( 2), 0xfcefa3f8,  9) STEP(G, c, d, a, b, GET( 7), 0x676f02d9, 14) STEP(G, b, c, d, a, GET(12), 0x8d2a4c8a, 20)
+			STEP(H, a, b, c, d, GET( 5), 0xfffa3942,  4) STEP(J, d, a, b, c, GET( 8), 0x8771f681, 11) STEP(H, c, d, a, b, GET(11), 0x6d9d6122, 16) STEP(J, b, c, d, a, GET(14), 0xfde5380c, 23)
+			STEP(H, a, b, c, d, GET( 1), 0xa4beea44,  4) STEP(J, d, a, b, c, GET( 4), 0x4bdecfa9, 11) STEP(H, c, d, a, b, GET( 7), 0xf6bb4b60, 16) STEP(J, b, c, d, a, GET(10), 0xbebfbc70, 23)
+			STEP(H, a, b, c, d, GET(13), 0x289b7ec6,  4) STEP(J, d, a, b, c, GET( 0), 0xeaa127fa, 11) STEP(H, c, d, a, b, GET( 3), 0xd4ef3085, 16) STEP(J, b, c, d, a, GET( 6), 0x04881d05, 23)
+			STEP(H, a, b, c, d, GET( 9), 0xd9d4d039,  4) STEP(J, d, a, b, c, GET(12), 0xe6db99e5, 11) STEP(H, c, d, a, b, GET(15), 0x1fa27cf8, 16) STEP(J, b, c, d, a, GET( 2), 0xc4ac5665, 23)
+			STEP(I, a, b, c, d, GET( 0), 0xf4292244,  6) STEP(I, d, a, b, c, GET( 7), 0x432aff97, 10) STEP(I, c, d, a, b, GET(14), 0xab9423a7, 15) STEP(I, b, c, d, a, GET( 5), 0xfc93a039, 21)
+			STEP(I, a, b, c, d, GET(12), 0x655b59c3,  6) STEP(I, d, a, b, c, GET( 3), 0x8f0ccc92, 10) STEP(I, c, d, a, b, GET(10), 0xffeff47d, 15) STEP(I, b, c, d, a, GET( 1), 0x85845dd1, 21)
+			STEP(I, a, b, c, d, GET( 8), 0x6fa87e4f,  6) STEP(I, d, a, b, c, GET(15), 0xfe2ce6e0, 10) STEP(I, c, d, a, b, GET( 6), 0xa3014314, 15) STEP(I, b, c, d, a, GET(13), 0x4e0811a1, 21)
+			STEP(I, a, b, c, d, GET( 4), 0xf7537e82,  6) STEP(I, d, a, b, c, GET(11), 0xbd3af235, 10) STEP(I, c, d, a, b, GET( 2), 0x2ad7d2bb, 15) STEP(I, b, c, d, a, GET( 9), 0xeb86d391, 21)
+			#undef F
+			#undef G
+			#undef H
+			#undef J
+			#undef I
+			#undef GET
+			#undef SET
+			#undef STEP
+			a += saved_a; b += saved_b; c += saved_c; d += saved_d; ptr += 64;
+		} while (size -= 64);
+		A = a; B = b; C = c; D = d;
+		return ptr;
+	}
+};
 
-static void SHA1(const Bit8u* data, size_t data_size, Bit8u res[20])
+struct SHA1Impl
 {
+	// Processes num 64 byte blocks
+	void (*Blocks)(Bit32u state[5], const Bit8u* p, size_t num);
+
+	static const SHA1Impl& Get() { static const SHA1Impl impl; return impl; }
+
+	SHA1Impl()
+	{
+		Blocks = BlocksPortable;
+		#ifdef CHDTOOGG_X86
+		Bit32u regs[4], leaf1ecx, leaf7ebx = 0;
+		CPUID(0, 0, regs);
+		if (regs[0] < 1) return;
+		if (regs[0] >= 7) { CPUID(7, 0, regs); leaf7ebx = regs[1]; }
+		CPUID(1, 0, regs); leaf1ecx = regs[2];
+		if ((leaf7ebx & (1 << 29)) && (leaf1ecx & (1 << 19)) && (leaf1ecx & (1 << 9))) Blocks = BlocksSHANI; // SHA, SSE4.1 and SSSE3
+		else if (leaf1ecx & (1 << 9)) Blocks = BlocksSSSE3;
+		#elif defined(CHDTOOGG_ARM)
+		if (ARMFeatures() & ARM_SHA1) Blocks = BlocksARM;
+		#endif
+	}
+
 	// BASED ON SHA-1 in C (public domain)
 	// By Steve Reid - https://github.com/clibs/sha1
-	struct SHA1_CTX
+	static void BlocksPortable(Bit32u* state, const Bit8u* buffer, size_t num)
 	{
-		static void Transform(Bit32u* state, const Bit8u* buffer)
+		for (; num--; buffer += 64)
 		{
 			Bit32u block[16]; memcpy(block, buffer, 64); // Non destructive (can have input buffer be const)
-			//Bit32u* block = buffer; // Destructive (buffer will be modified in place)
 			Bit32u a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
 			#define SHA1ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 			#ifdef WORDS_BIGENDIAN
@@ -211,354 +458,3514 @@ static void SHA1(const Bit8u* data, size_t data_size, Bit8u res[20])
 			SHA1R4(e,a,b,c,d,76); SHA1R4(d,e,a,b,c,77); SHA1R4(c,d,e,a,b,78); SHA1R4(b,c,d,e,a,79);
 			state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
 		}
-		void Process(const Bit8u* data, size_t len)
-		{
-			size_t i; Bit32u j = count[0];
-			if ((count[0] += (Bit32u)(len << 3)) < j) count[1]++;
-			count[1] += (Bit32u)(len>>29);
-			j = (j >> 3) & 63;
-			if ((j + len) > 63)
-			{
-				memcpy(&buffer[j], data, (i = 64-j));
-				Transform(state, buffer);
-				for (; i + 63 < len; i += 64) Transform(state, &data[i]);
-				j = 0;
-			}
-			else i = 0;
-			memcpy(&buffer[j], &data[i], len - i);
-		}
-		Bit32u count[2], state[5];
-		Bit8u buffer[64];
-	} ctx;
-	ctx.count[0] = ctx.count[1] = 0;
-	ctx.state[0] = 0x67452301;
-	ctx.state[1] = 0xEFCDAB89;
-	ctx.state[2] = 0x98BADCFE;
-	ctx.state[3] = 0x10325476;
-	ctx.state[4] = 0xC3D2E1F0;
-	ctx.Process(data, data_size);
-	Bit8u finalcount[8];
-	for (unsigned i = 0; i < 8; i++)  finalcount[i] = (Bit8u)((ctx.count[(i >= 4 ? 0 : 1)] >> ((3-(i & 3)) * 8) ) & 255);
-	Bit8u c = 0200;
-	ctx.Process(&c, 1);
-	while ((ctx.count[0] & 504) != 448) { c = 0000; ctx.Process(&c, 1); }
-	ctx.Process(finalcount, 8);
-	for (unsigned j = 0; j < 20; j++) res[j] = (Bit8u)((ctx.state[j>>2] >> ((3-(j & 3)) * 8) ) & 255);
-}
+	}
 
-int main(int argc, const char** argv)
-{
-	// Very simple test if the ogg encoding produces the expected bits
-	struct TestEncode
+	#ifdef CHDTOOGG_X86
+	// Message schedule calculated 4 words at a time as described in "Improving the Performance of the Secure Hash Algorithm (SHA-1)" by Intel
+	CHDTOOGG_TARGET("ssse3") static void BlocksSSSE3(Bit32u* state, const Bit8u* buffer, size_t num)
 	{
-		enum { TEST_LEN = 5000, TEST_EXPECT_CRC = 0x79d89c91 };
-		float buf[TEST_LEN], *bufp; Bit32u crc;
-		static uint32_t FeedSamples(float* bufL, float* bufR, uint32_t num, TestEncode* self)
+		const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+		const __m128i k[4] = { _mm_set1_epi32(0x5A827999), _mm_set1_epi32(0x6ED9EBA1), _mm_set1_epi32((int)0x8F1BBCDC), _mm_set1_epi32((int)0xCA62C1D6) };
+		__m128i w[20];
+		Bit32u wk[80];
+		for (; num--; buffer += 64)
 		{
-			uint32_t remain = (uint32_t)(self->buf + TEST_LEN - self->bufp);
-			if (remain < num) num = remain;
-			memcpy(bufL, self->bufp, num*4); memcpy(bufR, self->bufp, num*4);
-			self->bufp += num;
-			return num;
-		}
-		static void OggOutput(const void* data, uint32_t len, TestEncode* self) { self->crc ^= CRC32(data, len); }
-	} *testenc = (TestEncode*)malloc(sizeof(TestEncode));
+			for (int i = 0; i != 4; i++) w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buffer + i), bswap);
+			for (int i = 4; i != 20; i++)
+			{
+				// W[t] = rol(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16], 1) where the last lane depends on the first lane of the same step
+				__m128i t = _mm_xor_si128(_mm_xor_si128(_mm_srli_si128(w[i - 1], 4), w[i - 2]), _mm_xor_si128(_mm_alignr_epi8(w[i - 3], w[i - 4], 8), w[i - 4]));
+				__m128i t0 = _mm_slli_si128(t, 12);
+				w[i] = _mm_xor_si128(_mm_or_si128(_mm_slli_epi32(t, 1), _mm_srli_epi32(t, 31)), _mm_or_si128(_mm_slli_epi32(t0, 2), _mm_srli_epi32(t0, 30)));
+			}
+			for (int i = 0; i != 20; i++) _mm_storeu_si128((__m128i*)(wk + i * 4), _mm_add_epi32(w[i], k[i / 5]));
 
-	for (float *bufp = testenc->buf, *bufpend = bufp + TestEncode::TEST_LEN, seed = 0; bufp != bufpend; bufp++)
-		*bufp = (seed += (seed > 1 ? -1 : 0.000188019f*(bufpend-bufp)));
-	testenc->bufp = testenc->buf;
-	testenc->crc = 0;
-	WasmEncodeVorbis(5, (fnEncodeVorbisFeedSamples)TestEncode::FeedSamples, (fnEncodeVorbisOutput)TestEncode::OggOutput, testenc);
-	Bit32u testrescrc = testenc->crc;
-	free(testenc);
-	if (testrescrc != TestEncode::TEST_EXPECT_CRC)
-	{
-		fprintf(stderr, "This system failed to produce the expected encoding results, please report this as a bug at https://github.com/PureDOS/CHDtoOGG\n\n");
-		fprintf(stderr, "Expected result: 0x%08x - Test result: 0x%08x\n\n", TestEncode::TEST_EXPECT_CRC, testrescrc);
-		return 1;
+			Bit32u a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+			#define SHA1WK0(v,w,x,y,z,i) z+=((w&(x^y))^y)+wk[i]+SHA1ROL(v,5);w=SHA1ROL(w,30);
+			#define SHA1WK1(v,w,x,y,z,i) z+=(w^x^y)+wk[i]+SHA1ROL(v,5);w=SHA1ROL(w,30);
+			#define SHA1WK2(v,w,x,y,z,i) z+=(((w|x)&y)|(w&x))+wk[i]+SHA1ROL(v,5);w=SHA1ROL(w,30);
+			#define SHA1WK5(R,i) R(a,b,c,d,e,i+0); R(e,a,b,c,d,i+1); R(d,e,a,b,c,i+2); R(c,d,e,a,b,i+3); R(b,c,d,e,a,i+4);
+			SHA1WK5(SHA1WK0, 0) SHA1WK5(SHA1WK0, 5) SHA1WK5(SHA1WK0,10) SHA1WK5(SHA1WK0,15)
+			SHA1WK5(SHA1WK1,20) SHA1WK5(SHA1WK1,25) SHA1WK5(SHA1WK1,30) SHA1WK5(SHA1WK1,35)
+			SHA1WK5(SHA1WK2,40) SHA1WK5(SHA1WK2,45) SHA1WK5(SHA1WK2,50) SHA1WK5(SHA1WK2,55)
+			SHA1WK5(SHA1WK1,60) SHA1WK5(SHA1WK1,65) SHA1WK5(SHA1WK1,70) SHA1WK5(SHA1WK1,75)
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+		}
 	}
 
-	// Parse commandline arguments
-	const char *inPathCHD = NULL, *outPathCUE = NULL, *qualityStr = NULL, *noData = NULL, *showXML = NULL;
-	for (int i = 1; i < argc; i++)
+	CHDTOOGG_TARGET("sha,sse4.1,ssse3") static void BlocksSHANI(Bit32u* state, const Bit8u* buffer, size_t num)
 	{
-		if ((argv[i][0] != '-' && argv[i][0] != '/') || !argv[i][1] || argv[i][2]) goto argerr;
-		switch (argv[i][1])
+		const __m128i bswap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+		__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B), e0 = _mm_set_epi32((int)state[4], 0, 0, 0), e1;
+		for (; num--; buffer += 64)
 		{
-			case 'i': if (inPathCHD  || ++i == argc) goto argerr; inPathCHD  = argv[i]; continue;
-			case 'o': if (outPathCUE || ++i == argc) goto argerr; outPathCUE = argv[i]; continue;
-			case 'q': if (qualityStr || ++i == argc) goto argerr; qualityStr = argv[i]; continue;
-			case 'n': if (noData ) goto argerr; noData  = argv[i]; continue;
-			case 'x': if (showXML) goto argerr; showXML = argv[i]; continue;
+			__m128i abcd_save = abcd, e0_save = e0;
+			__m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buffer + 0), bswap), m1, m2, m3;
+
+			// Each step does 4 rounds and continues the message schedule of the 4 following words
+			#define SHA1NI(g, En, Eo, Mg, M1, M2, M3) \
+				En = _mm_sha1nexte_epu32(En, Mg); Eo = abcd; \
+				if (g >= 3 && g <= 18) M1 = _mm_sha1msg2_epu32(M1, Mg); \
+				abcd = _mm_sha1rnds4_epu32(abcd, En, g / 5); \
+				if (g >= 1 && g <= 16) M3 = _mm_sha1msg1_epu32(M3, Mg); \
+				if (g >= 2 && g <= 17) M2 = _mm_xor_si128(M2, Mg);
+			e0 = _mm_add_epi32(e0, m0); e1 = abcd; abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+			m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buffer + 1), bswap);
+			SHA1NI( 1, e1, e0, m1, m2, m3, m0)
+			m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buffer + 2), bswap);
+			SHA1NI( 2, e0, e1, m2, m3, m0, m1)
+			m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)buffer + 3), bswap);
+			SHA1NI( 3, e1, e0, m3, m0, m1, m2) SHA1NI( 4, e0, e1, m0, m1, m2, m3) SHA1NI( 5, e1, e0, m1, m2, m3, m0) SHA1NI( 6, e0, e1, m2, m3, m0, m1)
+			SHA1NI( 7, e1, e0, m3, m0, m1, m2) SHA1NI( 8, e0, e1, m0, m1, m2, m3) SHA1NI( 9, e1, e0, m1, m2, m3, m0) SHA1NI(10, e0, e1, m2, m3, m0, m1)
+			SHA1NI(11, e1, e0, m3, m0, m1, m2) SHA1NI(12, e0, e1, m0, m1, m2, m3) SHA1NI(13, e1, e0, m1, m2, m3, m0) SHA1NI(14, e0, e1, m2, m3, m0, m1)
+			SHA1NI(15, e1, e0, m3, m0, m1, m2) SHA1NI(16, e0, e1, m0, m1, m2, m3) SHA1NI(17, e1, e0, m1, m2, m3, m0) SHA1NI(18, e0, e1, m2, m3, m0, m1)
+			SHA1NI(19, e1, e0, m3, m0, m1, m2)
+			#undef SHA1NI
+			e0 = _mm_sha1nexte_epu32(e0, e0_save);
+			abcd = _mm_add_epi32(abcd, abcd_save);
 		}
-		argerr: fprintf(stderr, "Unknown command line option '%s'.\n\n", argv[i]); goto help;
+		_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+		state[4] = (Bit32u)_mm_extract_epi32(e0, 3);
 	}
-	if (!inPathCHD || !*inPathCHD || !outPathCUE || !*outPathCUE)
+	#endif
+
+	#ifdef CHDTOOGG_ARM
+	CHDTOOGG_TARGET("+crypto") static void BlocksARM(Bit32u* state, const Bit8u* buffer, size_t num)
 	{
-		help:
-		fprintf(stderr, "%s v%s - Command line options:\n"
-			"  -i <PATH>  : Path to input CHD file (required)\n"
-			"  -o <PATH>  : Path to output CUE file (required)\n"
-			"  -q <LEVEL> : Quality level 0 to 10, defaults to 8\n"
-			"  -n         : Output an empty data track\n"
-			"  -x         : Print XML DAT meta data\n"
-			"\n", "CHDtoOGG", "1.2");
-		return 1;
+		static const Bit32u k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+		uint32x4_t abcd = vld1q_u32(state);
+		Bit32u e0 = state[4], e1;
+		for (; num--; buffer += 64)
+		{
+			uint32x4_t abcd_save = abcd, m[4], tmp[2];
+			Bit32u e0_save = e0;
+			for (int i = 0; i != 4; i++) m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + i * 16)));
+			tmp[0] = vaddq_u32(m[0], vdupq_n_u32(k[0]));
+			tmp[1] = vaddq_u32(m[1], vdupq_n_u32(k[0]));
+
+			// Each step does 4 rounds and continues the message schedule of the words needed 3 and 4 steps later
+			#define SHA1ARM(g, En, Eo, fn) \
+				En = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+				abcd = fn(abcd, Eo, tmp[g & 1]); \
+				if (g <= 17) tmp[g & 1] = vaddq_u32(m[(g + 2) & 3], vdupq_n_u32(k[(g + 2) / 5])); \
+				if (g >= 1 && g <= 16) m[(g + 3) & 3] = vsha1su1q_u32(m[(g + 3) & 3], m[(g + 2) & 3]); \
+				if (g <= 15) m[g & 3] = vsha1su0q_u32(m[g & 3], m[(g + 1) & 3], m[(g + 2) & 3]);
+			SHA1ARM( 0, e1, e0, vsha1cq_u32) SHA1ARM( 1, e0, e1, vsha1cq_u32) SHA1ARM( 2, e1, e0, vsha1cq_u32) SHA1ARM( 3, e0, e1, vsha1cq_u32) SHA1ARM( 4, e1, e0, vsha1cq_u32)
+			SHA1ARM( 5, e0, e1, vsha1pq_u32) SHA1ARM( 6, e1, e0, vsha1pq_u32) SHA1ARM( 7, e0, e1, vsha1pq_u32) SHA1ARM( 8, e1, e0, vsha1pq_u32) SHA1ARM( 9, e0, e1, vsha1pq_u32)
+			SHA1ARM(10, e1, e0, vsha1mq_u32) SHA1ARM(11, e0, e1, vsha1mq_u32) SHA1ARM(12, e1, e0, vsha1mq_u32) SHA1ARM(13, e0, e1, vsha1mq_u32) SHA1ARM(14, e1, e0, vsha1mq_u32)
+			SHA1ARM(15, e0, e1, vsha1pq_u32) SHA1ARM(16, e1, e0, vsha1pq_u32) SHA1ARM(17, e0, e1, vsha1pq_u32) SHA1ARM(18, e1, e0, vsha1pq_u32) SHA1ARM(19, e0, e1, vsha1pq_u32)
+			#undef SHA1ARM
+			abcd = vaddq_u32(abcd, abcd_save);
+			e0 += e0_save;
+		}
+		vst1q_u32(state, abcd);
+		state[4] = e0;
 	}
-	int qualityRaw = (qualityStr ? atoi(qualityStr) : 8);
-	int quality = (qualityRaw < 0 ? 0 : qualityRaw > 10 ? 10 : qualityRaw);
+	#endif
+};
 
-	enum { CHD_V5_HEADER_SIZE = 124, CHD_V5_UNCOMPMAPENTRYBYTES = 4, CD_MAX_SECTOR_DATA = 2352, CD_MAX_SUBCODE_DATA = 96, CD_FRAME_SIZE = CD_MAX_SECTOR_DATA + CD_MAX_SUBCODE_DATA };
-	enum { METADATA_HEADER_SIZE = 16, CDROM_TRACK_METADATA_TAG = 1128813650, CDROM_TRACK_METADATA2_TAG = 1128813618, CD_TRACK_PADDING = 4 };
+// Digests of a file as listed in the XML metadata
+struct HashResult
+{
+	Bit32u crc32;
+	Bit8u md5[16], sha1[20];
+};
 
-	// Read CHD header and check signature
-	Bit32u* chd_hunkmap = NULL;
-	Bit8u rawheader[CHD_V5_HEADER_SIZE];
-	const char* chd_errstr = NULL;
-	FILE* fCHD = fopen(inPathCHD, "rb");
-	if (!fCHD || !fread(rawheader, CHD_V5_HEADER_SIZE, 1, fCHD) || memcmp(rawheader, "MComprHD", 8))
+// Incremental context which calculates CRC32, MD5 and SHA-1 in a single pass, all three run over a chunk while it is still in the cache
+struct HashCtx
+{
+	enum { CHUNK_BLOCKS = 256 }; // 16 KB
+	Bit32u crc, md5[4], sha1[5];
+	Bit64u size, crcBegin, crcEnd; // the CRC only covers the data between crcBegin and crcEnd
+	Bit8u buf[64];
+	bool sha1Only; // MD5 is skipped and the CRC range is empty
+
+	void Init(Bit64u crcFrom = 0, Bit64u crcTo = (Bit64u)-1)
 	{
-		chderr:
-		fprintf(stderr, (chd_errstr ? chd_errstr : "Error: Invalid/unsupported CHD file '%s'\n\n"), inPathCHD);
-		if (chd_hunkmap) free(chd_hunkmap);
-		goto help;
+		static const Bit32u iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+		sha1Only = false;
+		crc = 0;
+		size = 0;
+		crcBegin = crcFrom;
+		crcEnd = crcTo;
+		memcpy(md5, iv, sizeof(md5));
+		memcpy(sha1, iv, sizeof(sha1));
 	}
 
-	// Check supported version, flags and compression
-	Bit32u hdr_length = CHD_READ_BE32(&rawheader[8]);
-	Bit32u hdr_version = CHD_READ_BE32(&rawheader[12]);
-	if (hdr_version != 5 || hdr_length != CHD_V5_HEADER_SIZE) goto chderr; // only ver 5 is supported
-	if (CHD_READ_BE32(&rawheader[16])) { chd_errstr = "Error: Compressed CHD file '%s' is not supported. CHD file needs to be made with `chdman createcd -c none`."; goto chderr; }
-
-	// Make sure it's a CD image
-	Bit32u unitsize = CHD_READ_BE32(&rawheader[60]);
-	int chd_hunkbytes = (int)CHD_READ_BE32(&rawheader[56]);
-	if (unitsize != CD_FRAME_SIZE || (chd_hunkbytes % CD_FRAME_SIZE) || !chd_hunkbytes) goto chderr; // not CD sector size
+	void InitSHA1()
+	{
+		Init(0, 0);
+		sha1Only = true;
+	}
 
-	// Read file offsets for hunk mapping and track meta data
-	fseek_wrap(fCHD, 0, SEEK_END);
-	Bit64u chd_size = (Bit64u)ftell_wrap(fCHD);
-	Bit64u logicalbytes = CHD_READ_BE64(&rawheader[32]);
-	Bit64u mapoffset = CHD_READ_BE64(&rawheader[40]);
-	Bit64u metaoffset = CHD_READ_BE64(&rawheader[48]);
-	if (mapoffset < CHD_V5_HEADER_SIZE || mapoffset >= chd_size || metaoffset < CHD_V5_HEADER_SIZE || metaoffset >= chd_size || !logicalbytes) goto chderr;
+	void Update(const void* data, size_t len)
+	{
+		const Bit8u* p = (const Bit8u*)data;
+		for (size_t n; len; p += n, len -= n)
+		{
+			n = (len < CHUNK_BLOCKS * 64 ? len : CHUNK_BLOCKS * 64);
+			UpdateCRC(p, n);
+			size_t fill = (size_t)(size & 63), i = 0;
+			size += n;
+			if (fill)
+			{
+				i = (n < 64 - fill ? n : 64 - fill);
+				memcpy(buf + fill, p, i);
+				if (fill + i != 64) continue;
+				Blocks(buf, 1);
+			}
+			Blocks(p + i, (n - i) / 64);
+			memcpy(buf, p + i + ((n - i) & ~(size_t)63), (n - i) & 63);
+		}
+	}
 
-	// Read hunk mapping and convert to file offsets
-	Bit32u hunkcount = (Bit32u)((logicalbytes + chd_hunkbytes - 1) / chd_hunkbytes);
-	if (chd_size < mapoffset + hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES) goto chderr;
-	chd_hunkmap = (Bit32u*)malloc(hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES);
-	fseek_wrap(fCHD, mapoffset, SEEK_SET);
-	if (!fread(chd_hunkmap, hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES, 1, fCHD)) goto chderr;
-	for (Bit32u j = 0; j != hunkcount; j++)
+	void Final(HashResult& res)
 	{
-		chd_hunkmap[j] = CHD_READ_BE32(&chd_hunkmap[j]) * chd_hunkbytes;
-		if (chd_size < chd_hunkmap[j] + chd_hunkbytes) goto chderr;
+		// MD5 and SHA-1 pad the same way except for the byte order of the bit length at the end
+		size_t fill = (size_t)(size & 63), padlen = (fill < 56 ? 64 : 128);
+		Bit64u bits = size << 3;
+		Bit8u pad[128];
+		memcpy(pad, buf, fill);
+		pad[fill] = 0x80;
+		memset(pad + fill + 1, 0, padlen - 8 - fill - 1);
+		for (int i = 0; i != 8; i++) pad[padlen - 8 + i] = (Bit8u)(bits >> (i * 8));
+		if (!sha1Only) MD5Blocks(md5, pad, padlen / 64);
+		for (int i = 0; i != 8; i++) pad[padlen - 8 + i] = (Bit8u)(bits >> (56 - i * 8));
+		SHA1Impl::Get().Blocks(sha1, pad, padlen / 64);
+		res.crc32 = crc;
+		for (int i = 0; i != 16; i++) res.md5[i] = (Bit8u)(md5[i >> 2] >> ((i & 3) * 8));
+		for (int i = 0; i != 20; i++) res.sha1[i] = (Bit8u)(sha1[i >> 2] >> ((3 - (i & 3)) * 8));
 	}
 
-	FILE* fCUE = fopen(outPathCUE, "wb");
-	if (!fCUE)
+	// Continues the CRC with len bytes at the current size position
+	void UpdateCRC(const Bit8u* p, size_t len)
 	{
-		fprintf(stderr, "Error: Unable to write output CUE file '%s'\n\n", outPathCUE);
-		free(chd_hunkmap);
-		goto help;
+		Bit64u from = (size > crcBegin ? size : crcBegin), to = (size + len < crcEnd ? size + len : crcEnd);
+		if (from < to) crc = CRC32(p + (size_t)(from - size), (size_t)(to - from), crc);
 	}
 
-	std::vector< std::vector<char> > cueTracks, xmlTracks;
-	std::string pathTrack = outPathCUE;
-	const char *cueLastFS = strrchr(outPathCUE, '/'), *cueLastBS = strrchr(outPathCUE, '\\'), *cueLastS = (cueLastFS > cueLastBS ? cueLastFS : cueLastBS);
-	size_t pathTrackBaseLen = (pathTrack.size() - 4), pathDirLen = (size_t)((cueLastS ? (cueLastS + 1) : outPathCUE) - outPathCUE);
+	// Runs MD5 and SHA-1 over num 64 byte blocks
+	void Blocks(const Bit8u* p, size_t num)
+	{
+		if (!sha1Only) MD5Blocks(md5, p, num);
+		SHA1Impl::Get().Blocks(sha1, p, num);
+	}
 
-	// Read track meta data
-	Bit32u track_frame = 0;
-	for (Bit64u metaentry_offset = metaoffset, metaentry_next; metaentry_offset != 0; metaentry_offset = metaentry_next)
+	static void MD5Blocks(Bit32u state[4], const Bit8u* p, size_t num)
 	{
-		char mt_type[32], mt_subtype[32];
-		if (chd_size < metaentry_offset + METADATA_HEADER_SIZE) goto chderr;
-		Bit8u raw_meta_header[METADATA_HEADER_SIZE];
-		fseek_wrap(fCHD, metaentry_offset, SEEK_SET);
-		if (!fread(raw_meta_header, METADATA_HEADER_SIZE, 1, fCHD)) goto chderr;
-		Bit32u metaentry_metatag = CHD_READ_BE32(&raw_meta_header[0]);
-		Bit32u metaentry_length = (CHD_READ_BE32(&raw_meta_header[4]) & 0x00ffffff);
-		metaentry_next = CHD_READ_BE64(&raw_meta_header[8]);
-		if (metaentry_metatag != CDROM_TRACK_METADATA_TAG && metaentry_metatag != CDROM_TRACK_METADATA2_TAG) continue;
-		if (chd_size < (size_t)(metaentry_offset + METADATA_HEADER_SIZE) + metaentry_length) goto chderr;
+		if (!num) return;
+		MD5_CTX ctx = { state[0], state[1], state[2], state[3] };
+		ctx.Body(p, num * 64);
+		state[0] = ctx.A; state[1] = ctx.B; state[2] = ctx.C; state[3] = ctx.D;
+	}
+};
 
-		int mt_track_no = 0, mt_frames = 0, mt_pregap = 0;
-		if (fscanf(fCHD,
-			(metaentry_metatag == CDROM_TRACK_METADATA2_TAG ? "TRACK:%d TYPE:%30s SUBTYPE:%30s FRAMES:%d PREGAP:%d" : "TRACK:%d TYPE:%30s SUBTYPE:%30s FRAMES:%d"),
-			&mt_track_no, mt_type, mt_subtype, &mt_frames, &mt_pregap) < 4) continue;
-		if (mt_pregap > mt_frames) { chd_errstr = "Error: Track pregap is larger than total track frame count\n"; goto chderr; }
+// Job for HashMulti which calculates the hashes of multiple independent buffers together
+struct HashJob
+{
+	const Bit8u* data;
+	size_t size, crcBegin, crcEnd; // see HashCtx
+	HashResult res;
+};
 
-		// In CHD files tracks are padded to a to a 4-sector boundary.
-		track_frame += ((CD_TRACK_PADDING - (track_frame % CD_TRACK_PADDING)) % CD_TRACK_PADDING);
+// Multi-buffer hashing processes the blocks of up to 8 messages in parallel in the lanes of SIMD registers
+struct MultiHashImpl
+{
+	enum { MAX_LANES = 8 };
+	typedef void (*LaneBlockFn)(Bit32u state[][MAX_LANES], const Bit8u* const blocks[MAX_LANES]);
+	int lanes, md5MinActive, sha1MinActive; // below the minimum number of active lanes the remaining buffers are faster to hash one by one
+	LaneBlockFn md5Lanes, sha1Lanes; // null if there is no SIMD version
 
-		const bool isAudio = !strcmp(mt_type, "AUDIO");
-		pathTrack.resize(pathTrackBaseLen);
-		pathTrack.append(" (Track ");
-		if (mt_track_no > 99) pathTrack += (char)('0' + (mt_track_no/100)%10);
-		if (mt_track_no > 9) pathTrack += (char)('0' + (mt_track_no/10)%10);
-		pathTrack += (char)('0' + (mt_track_no%10));
-		pathTrack.append(isAudio ? ").ogg" : ").bin");
-		FILE* fOut = fopen(pathTrack.c_str(), "wb");
-		fprintf(stderr, "%s track %d %s ...\n", (isAudio ? "Compressing" : "Writing"), mt_track_no, pathTrack.c_str());
-		if (!fOut) { chd_errstr = "Error: Unable to write track file\n"; goto chderr; }
+	static const MultiHashImpl& Get() { static const MultiHashImpl impl; return impl; }
 
-		// Read track data and calculate hashes (CHD sectorSize is always 2448, data_size is based on chdman source, except MODE2_FORM2 is treated same as MODE2_FORM1 because sector size 2324 is unsupported in BIN/CUE)
-		const bool ds2048 = !strcmp(mt_type, "MODE1") || !strcmp(mt_type, "MODE2_FORM1") || !strcmp(mt_type, "MODE2_FORM2");
-		const bool ds2336 = !strcmp(mt_type, "MODE2") || !strcmp(mt_type, "MODE2_FORM_MIX");
-		const size_t data_size = (ds2048 ? 2048 : ds2336 ? 2336 : CD_MAX_SECTOR_DATA);
-		const size_t track_size = (size_t)mt_frames * data_size, pregap_size = (size_t)mt_pregap * data_size;
-		Bit8u* track_data = (Bit8u*)malloc(track_size), *track_out = track_data;
-		for (Bit32u track_frame_end = track_frame + mt_frames; track_frame != track_frame_end; track_frame++, track_out += data_size)
+	MultiHashImpl() : lanes(1), md5MinActive(2), sha1MinActive(2), md5Lanes(NULL), sha1Lanes(NULL)
+	{
+		#ifdef CHDTOOGG_X86
+		Bit32u regs[4], maxLeaf, leaf1ecx;
+		CPUID(0, 0, regs);
+		if ((maxLeaf = regs[0]) < 1) return;
+		CPUID(1, 0, regs); leaf1ecx = regs[2];
+		if (regs[3] & (1 << 26)) { lanes = 4; md5Lanes = MD5x4; sha1Lanes = SHA1x4; } // SSE2
+		if (maxLeaf >= 7 && (leaf1ecx & (1 << 27)) && (XGETBV0() & 6) == 6) // AVX2 and the OS saves YMM registers
 		{
-			size_t p = track_frame * CD_FRAME_SIZE, hunk = (p / chd_hunkbytes), hunk_ofs = (p % chd_hunkbytes), hunk_pos = chd_hunkmap[hunk];
-			if (!hunk_pos) { memset(track_out, 0, data_size); continue; }
-			fseek_wrap(fCHD, hunk_pos + hunk_ofs, SEEK_SET);
-			if (!fread(track_out, data_size, 1, fCHD)) { free(track_data); chd_errstr = "Error: Failed to read from source file '%s'\n"; goto chderr; }
+			CPUID(7, 0, regs);
+			if (regs[1] & (1 << 5)) { lanes = 8; md5MinActive = 3; md5Lanes = MD5x8; sha1Lanes = SHA1x8; }
 		}
+		if (SHA1Impl::Get().Blocks == SHA1Impl::BlocksSHANI) { sha1MinActive = 6; if (lanes < 8) sha1Lanes = NULL; } // SHA-NI is about as fast as 5 lanes
+		#endif
+	}
 
-		if (cueTracks.size() < (size_t)mt_track_no) { cueTracks.resize((size_t)mt_track_no); xmlTracks.resize((size_t)mt_track_no); }
-		std::vector<char> &cueTrack = cueTracks[mt_track_no-1], &xmlTrack = xmlTracks[mt_track_no-1];
-		
-		struct Encode
+	// Each lane runs through the full blocks of its buffer one chunk at a time with all hashes fused like in HashCtx, the tail gets padded by HashCtx::Final
+	void Run(HashJob* jobs, size_t num) const
+	{
+		static const Bit8u zeroBlock[64] = { 0 };
+		struct Lane { HashJob* job; const Bit8u* p; size_t left; HashCtx ctx; } lane[MAX_LANES];
+		Bit32u state[5][MAX_LANES];
+		const Bit8u* blocks[MAX_LANES];
+		const SHA1Impl& sha1Impl = SHA1Impl::Get();
+		size_t next = 0;
+		for (int l = 0; l != MAX_LANES; l++) lane[l].job = NULL;
+		for (;;)
 		{
-			size_t wavpcmlen, wavpcmpos, romcap, romlen;
-			Bit8u *wavpcm, *rombuf;
-
-			static uint32_t FeedSamples(float* bufL, float* bufR, uint32_t num, Encode* self)
+			int active = 0;
+			size_t steps = HashCtx::CHUNK_BLOCKS;
+			for (int l = 0; l != lanes; l++)
 			{
-				uint32_t remain = (uint32_t)((self->wavpcmlen - self->wavpcmpos) / 4);
-				if (remain < num) num = remain;
-				signed char* pcm = (signed char*)(self->wavpcm + self->wavpcmpos);
-				for (uint32_t i = 0; i != num; i++, pcm += 4)
+				Lane& ln = lane[l];
+				for (;;)
 				{
-					bufL[i] = ((pcm[1] << 8) | (0x00ff & (int)pcm[0])) / 32768.f;
-					bufR[i] = ((pcm[3] << 8) | (0x00ff & (int)pcm[2])) / 32768.f;
+					if (ln.job && !ln.left)
+					{
+						ln.ctx.Update(ln.p, ln.job->size & 63);
+						ln.ctx.Final(ln.job->res);
+						ln.job = NULL;
+					}
+					if (ln.job || next == num) break;
+					ln.job = &jobs[next++];
+					ln.p = ln.job->data;
+					ln.left = ln.job->size / 64;
+					ln.ctx.Init(ln.job->crcBegin, ln.job->crcEnd);
 				}
-				if (!self->wavpcmpos && self->wavpcmlen >= 1024*1024) { fprintf(stderr, "  Progress: 0%%"); fflush(stderr); }
-				self->wavpcmpos += num * 4;
-				if ((self->wavpcmpos / (1024*1024)) != ((self->wavpcmpos - (num * 4)) / (1024*1024))) { fprintf(stderr, " .. %u%%", (uint32_t)(((uint64_t)self->wavpcmpos * 100 + 50) / self->wavpcmlen)); fflush(stderr); }
-				if (self->wavpcmpos == self->wavpcmlen && self->wavpcmlen >= 1024*1024 && num) fprintf(stderr, "\n");
-				return num;
+				if (!ln.job) continue;
+				active++;
+				if (ln.left < steps) steps = ln.left;
 			}
-			static void OggOutput(const void* data, uint32_t len, Encode* self)
+			if (!active) break;
+
+			for (int l = 0; l != lanes; l++)
 			{
-				while (self->romlen + len > self->romcap) self->rombuf = (Bit8u*)realloc(self->rombuf, (self->romcap += 1024*1024));
-				memcpy(self->rombuf + self->romlen, data, len);
-				self->romlen += len;
+				Lane& ln = lane[l];
+				if (!ln.job) continue;
+				ln.ctx.UpdateCRC(ln.p, steps * 64);
+				ln.ctx.size += steps * 64;
 			}
-		} enc = {0};
 
-		//Function to load data into out with 56448 bytes allocated (stored compressed in 2919 bytes)
-		extern void GetEmptyDataTrackBin(Bit8u*);
-		static Bit8u emptyDataTrackBin[24 * CD_MAX_SECTOR_DATA];
+			if (md5Lanes && active >= md5MinActive)
+			{
+				for (int l = 0; l != lanes; l++) if (lane[l].job) for (int w = 0; w != 4; w++) state[w][l] = lane[l].ctx.md5[w];
+				for (size_t s = 0; s != steps; s++)
+				{
+					for (int l = 0; l != lanes; l++) blocks[l] = (lane[l].job ? lane[l].p + s * 64 : zeroBlock);
+					md5Lanes(state, blocks);
+				}
+				for (int l = 0; l != lanes; l++) if (lane[l].job) for (int w = 0; w != 4; w++) lane[l].ctx.md5[w] = state[w][l];
+			}
+			else for (int l = 0; l != lanes; l++) if (lane[l].job) HashCtx::MD5Blocks(lane[l].ctx.md5, lane[l].p, steps);
 
-		Bit32u in_zeros = 0, out_zeros = 0;
-		if (isAudio)
-		{
-			// CHD audio endian swap
-			for (Bit8u *p = track_data, *pEnd = p + track_size, tmp; p != pEnd; p += 2)
-				{ tmp = p[0]; p[0] = p[1]; p[1] = tmp; }
-			// Additional info for audio tracks
-			for (; in_zeros != track_size && track_data[in_zeros] == 0; in_zeros++) {}
-			if (in_zeros != track_size) for (; out_zeros != track_size && track_data[track_size - 1 - out_zeros] == 0; out_zeros++) {}
-			if (pregap_size > in_zeros) { fprintf(stderr, "  Warning: Pregap for track %d contains audio data which will get omitted in exported OGG\n", mt_track_no); fflush(stderr); }
+			if (sha1Lanes && active >= sha1MinActive)
+			{
+				for (int l = 0; l != lanes; l++) if (lane[l].job) for (int w = 0; w != 5; w++) state[w][l] = lane[l].ctx.sha1[w];
+				for (size_t s = 0; s != steps; s++)
+				{
+					for (int l = 0; l != lanes; l++) blocks[l] = (lane[l].job ? lane[l].p + s * 64 : zeroBlock);
+					sha1Lanes(state, blocks);
+				}
+				for (int l = 0; l != lanes; l++) if (lane[l].job) for (int w = 0; w != 5; w++) lane[l].ctx.sha1[w] = state[w][l];
+			}
+			else for (int l = 0; l != lanes; l++) if (lane[l].job) sha1Impl.Blocks(lane[l].ctx.sha1, lane[l].p, steps);
 
-			enc.wavpcm = track_data + pregap_size;
-			enc.wavpcmlen = track_size - pregap_size;
-			WasmEncodeVorbis(quality, (fnEncodeVorbisFeedSamples)Encode::FeedSamples, (fnEncodeVorbisOutput)Encode::OggOutput, &enc);
-		}
-		else if (noData)
-		{
-			if (!emptyDataTrackBin[1]) GetEmptyDataTrackBin(emptyDataTrackBin);
-			enc.rombuf = emptyDataTrackBin;
-			enc.romlen = sizeof(emptyDataTrackBin);
-		}
-		else
-		{
-			enc.rombuf = track_data;
-			enc.romlen = track_size;
+			for (int l = 0; l != lanes; l++)
+			{
+				if (!lane[l].job) continue;
+				lane[l].p += steps * 64;
+				lane[l].left -= steps;
+			}
 		}
-		fwrite(enc.rombuf, enc.romlen, 1, fOut);
-		fclose(fOut);
+	}
 
-		cueTrack.resize(160 + (pathTrack.size() - pathDirLen));
-		char *pcue = &cueTrack[0], binTrackType[16];
-		sprintf(binTrackType, (isAudio ? "AUDIO" : "MODE%c/%04d"), (noData ? '1' : mt_type[4]), (noData ? 2352 : (int)data_size)); //noData is MODE1/2352
-		pcue += sprintf(pcue, "FILE \"%s\" %s\r\n", (pathTrack.c_str() + pathDirLen), (isAudio ? "MP3" : "BINARY"));
-		pcue += sprintf(pcue, "  TRACK %02d %s\r\n", mt_track_no, binTrackType);
-		if (!mt_pregap || (noData && !isAudio))
-		{
-			// Data or audio track without pregap
-			pcue += sprintf(pcue, "    INDEX 01 00:00:00\r\n");
-		}
-		else if (isAudio)
-		{
-			// We exclude the pregap data from the OGG encode and use the PREGAP tag to indicate that it has been omitted.
-			// Alternative would be to include the pregap data and use a pair of INDEX 00 and INDEX 01 tags but it is not well supported by existing emulators.
-			pcue += sprintf(pcue, "    PREGAP %02d:%02d:%02d\r\n", (mt_pregap/(60*75))%60, (mt_pregap/75)%60, mt_pregap%75);
-			pcue += sprintf(pcue, "    INDEX 01 00:00:00\r\n");
-		}
-		else
-		{
-			// Data track with pregap use a pair of INDEX 00 and INDEX 01 tags
-			pcue += sprintf(pcue, "    INDEX 00 00:00:00\r\n");
-			pcue += sprintf(pcue, "    INDEX 01 %02d:%02d:%02d\r\n", (mt_pregap/(60*75))%60, (mt_pregap/75)%60, mt_pregap%75);
+	#ifdef CHDTOOGG_X86
+	// The lane functions are written once with generic vector operations (MH*) which get defined for SSE2 and AVX2
+	#define MHROL(x, n) MHOR(MHSLL(x, n), MHSRL(x, 32 - (n)))
+	#define MHNOSWAP(x) (x)
+	#define MHLOADMSG(m, swap) \
+		for (int q = 0; q != 4; q++) \
+		{ \
+			MHV r0 = MHROW(0, q), r1 = MHROW(1, q), r2 = MHROW(2, q), r3 = MHROW(3, q); \
+			MHV t0 = MHUNPLO32(r0, r1), t1 = MHUNPLO32(r2, r3), t2 = MHUNPHI32(r0, r1), t3 = MHUNPHI32(r2, r3); \
+			m[q * 4 + 0] = swap(MHUNPLO64(t0, t1)); m[q * 4 + 1] = swap(MHUNPHI64(t0, t1)); \
+			m[q * 4 + 2] = swap(MHUNPLO64(t2, t3)); m[q * 4 + 3] = swap(MHUNPHI64(t2, t3)); \
 		}
 
-		if (showXML)
-		{
-			fprintf(stderr, "  Calculating checksum...\n");
-			Bit32u romcrc32 = CRC32(enc.rombuf, enc.romlen);
-			Bit8u rommd5[16], romsha1[20];
-			FastMD5(enc.rombuf, enc.romlen, rommd5);
-			SHA1(enc.rombuf, enc.romlen, romsha1);
-
-			for (size_t posAmp = pathDirLen - 1; (posAmp = pathTrack.find('&', posAmp + 1)) != std::string::npos;) pathTrack.insert(posAmp + 1, "amp;"); // encode & to &amp;
-			xmlTrack.resize(540 + (pathTrack.size() - pathDirLen));
-			char* pxml = &xmlTrack[0];
-			pxml += sprintf(pxml, "\t\t<rom name=\"%s\" size=\"%u\" crc=\"%08x\" md5=\"", (pathTrack.c_str() + pathDirLen), (unsigned)enc.romlen, romcrc32);
-			for (size_t posAmp = pathDirLen - 1; (posAmp = pathTrack.find('&', posAmp + 1)) != std::string::npos;) pathTrack.replace(posAmp + 1, 4, ""); // revert &amp; to &
-			for (int rommd5i = 0; rommd5i != 16; rommd5i++) pxml += sprintf(pxml, "%02x", rommd5[rommd5i]);
-			pxml += sprintf(pxml, "\" sha1=\"");
-			for (int romsha1i = 0; romsha1i != 20; romsha1i++) pxml += sprintf(pxml, "%02x", romsha1[romsha1i]);
-			pxml += sprintf(pxml, "\">\n");
-
-			Bit32u srccrc32; Bit8u srcmd5[16], srcsha1[20];
-			if (track_data != enc.rombuf) { srccrc32 = CRC32(track_data, (size_t)track_size); FastMD5(track_data, (size_t)track_size, srcmd5); SHA1(track_data, (size_t)track_size, srcsha1); }
-			else { srccrc32 = romcrc32; memcpy(srcmd5, rommd5, sizeof(srcmd5)); memcpy(srcsha1, romsha1, sizeof(srcsha1)); }
-
-			pxml += sprintf(pxml, "\t\t\t<source frames=\"%d\" pregap=\"%d\" duration=\"%02d:%02d:%02d\" size=\"%u\" crc=\"%08x\" md5=\"", mt_frames, mt_pregap, ((mt_frames/75/60)%100), (mt_frames/75)%60, mt_frames%75, (Bit32u)track_size, srccrc32);
-			for (int srcmd5i = 0; srcmd5i != 16; srcmd5i++) pxml += sprintf(pxml, "%02x", srcmd5[srcmd5i]);
-			pxml += sprintf(pxml, "\" sha1=\"");
-			for (int srcsha1i = 0; srcsha1i != 20; srcsha1i++) pxml += sprintf(pxml, "%02x", srcsha1[srcsha1i]);
-			if (isAudio) pxml += sprintf(pxml, "\" in_zeros=\"%u\" out_zeros=\"%u\" trimmed_crc=\"%08x\" quality=\"%d", in_zeros, out_zeros, CRC32(track_data + in_zeros, (size_t)(track_size - in_zeros - out_zeros)), quality);
-			if (isAudio && pregap_size > in_zeros) pxml += sprintf(pxml, "\" non_silence_pregap=\"1");
-			pxml += sprintf(pxml, "\"/>\n\t\t</rom>\n", in_zeros, out_zeros, CRC32(track_data + in_zeros, (size_t)(track_size - in_zeros - out_zeros)), quality);
-		}
-		if (enc.rombuf != track_data && enc.rombuf != emptyDataTrackBin) free(enc.rombuf);
-		free(track_data);
-		fprintf(stderr, "  Finished processing track %d!\n", mt_track_no);
+	#define MHMD5F(x, y, z) MHXOR(z, MHAND(x, MHXOR(y, z)))
+	#define MHMD5G(x, y, z) MHXOR(y, MHAND(z, MHXOR(x, y)))
+	#define MHMD5H(x, y, z) MHXOR(MHXOR(x, y), z)
+	#define MHMD5I(x, y, z) MHXOR(y, MHOR(x, MHXOR(z, MHSET1(0xFFFFFFFF))))
+	#define MHMD5STEP(f, a, b, c, d, k, t, s) a = MHADD(b, MHROL(MHADD(MHADD(a, f(b, c, d)), MHADD(m[k], MHSET1(t))), s));
+	#define MHMD5BODY \
+		MHV m[16], a = MHLOAD(state[0]), b = MHLOAD(state[1]), c = MHLOAD(state[2]), d = MHLOAD(state[3]), sa = a, sb = b, sc = c, sd = d; \
+		MHLOADMSG(m, MHNOSWAP) \
+		MHMD5STEP(MHMD5F, a, b, c, d,  0, 0xd76aa478,  7) MHMD5STEP(MHMD5F, d, a, b, c,  1, 0xe8c7b756, 12) MHMD5STEP(MHMD5F, c, d, a, b,  2, 0x242070db, 17) MHMD5STEP(MHMD5F, b, c, d, a,  3, 0xc1bdceee, 22) \
+		MHMD5STEP(MHMD5F, a, b, c, d,  4, 0xf57c0faf,  7) MHMD5STEP(MHMD5F, d, a, b, c,  5, 0x4787c62a, 12) MHMD5STEP(MHMD5F, c, d, a, b,  6, 0xa8304613, 17) MHMD5STEP(MHMD5F, b, c, d, a,  7, 0xfd469501, 22) \
+		MHMD5STEP(MHMD5F, a, b, c, d,  8, 0x698098d8,  7) MHMD5STEP(MHMD5F, d, a, b, c,  9, 0x8b44f7af, 12) MHMD5STEP(MHMD5F, c, d, a, b, 10, 0xffff5bb1, 17) MHMD5STEP(MHMD5F, b, c, d, a, 11, 0x895cd7be, 22) \
+		MHMD5STEP(MHMD5F, a, b, c, d, 12, 0x6b901122,  7) MHMD5STEP(MHMD5F, d, a, b, c, 13, 0xfd987193, 12) MHMD5STEP(MHMD5F, c, d, a, b, 14, 0xa679438e, 17) MHMD5STEP(MHMD5F, b, c, d, a, 15, 0x49b40821, 22) \
+		MHMD5STEP(MHMD5G, a, b, c, d,  1, 0xf61e2562,  5) MHMD5STEP(MHMD5G, d, a, b, c,  6, 0xc040b340,  9) MHMD5STEP(MHMD5G, c, d, a, b, 11, 0x265e5a51, 14) MHMD5STEP(MHMD5G, b, c, d, a,  0, 0xe9b6c7aa, 20) \
+		MHMD5STEP(MHMD5G, a, b, c, d,  5, 0xd62f105d,  5) MHMD5STEP(MHMD5G, d, a, b, c, 10, 0x02441453,  9) MHMD5STEP(MHMD5G, c, d, a, b, 15, 0xd8a1e681, 14) MHMD5STEP(MHMD5G, b, c, d, a,  4, 0xe7d3fbc8, 20) \
+		MHMD5STEP(MHMD5G, a, b, c, d,  9, 0x21e1cde6,  5) MHMD5STEP(MHMD5G, d, a, b, c, 14, 0xc33707d6,  9) MHMD5STEP(MHMD5G, c, d, a, b,  3, 0xf4d50d87, 14) MHMD5STEP(MHMD5G, b, c, d, a,  8, 0x455a14ed, 20) \
+		MHMD5STEP(MHMD5G, a, b, c, d, 13, 0xa9e3e905,  5) MHMD5STEP(MHMD5G, d, a, b, c,  2, 0xfcefa3f8,  9) MHMD5STEP(MHMD5G, c, d, a, b,  7, 0x676f02d9, 14) MHMD5STEP(MHMD5G, b, c, d, a, 12, 0x8d2a4c8a, 20) \
+		MHMD5STEP(MHMD5H, a, b, c, d,  5, 0xfffa3942,  4) MHMD5STEP(MHMD5H, d, a, b, c,  8, 0x8771f681, 11) MHMD5STEP(MHMD5H, c, d, a, b, 11, 0x6d9d6122, 16) MHMD5STEP(MHMD5H, b, c, d, a, 14, 0xfde5380c, 23) \
+		MHMD5STEP(MHMD5H, a, b, c, d,  1, 0xa4beea44,  4) MHMD5STEP(MHMD5H, d, a, b, c,  4, 0x4bdecfa9, 11) MHMD5STEP(MHMD5H, c, d, a, b,  7, 0xf6bb4b60, 16) MHMD5STEP(MHMD5H, b, c, d, a, 10, 0xbebfbc70, 23) \
+		MHMD5STEP(MHMD5H, a, b, c, d, 13, 0x289b7ec6,  4) MHMD5STEP(MHMD5H, d, a, b, c,  0, 0xeaa127fa, 11) MHMD5STEP(MHMD5H, c, d, a, b,  3, 0xd4ef3085, 16) MHMD5STEP(MHMD5H, b, c, d, a,  6, 0x04881d05, 23) \
+		MHMD5STEP(MHMD5H, a, b, c, d,  9, 0xd9d4d039,  4) MHMD5STEP(MHMD5H, d, a, b, c, 12, 0xe6db99e5, 11) MHMD5STEP(MHMD5H, c, d, a, b, 15, 0x1fa27cf8, 16) MHMD5STEP(MHMD5H, b, c, d, a,  2, 0xc4ac5665, 23) \
+		MHMD5STEP(MHMD5I, a, b, c, d,  0, 0xf4292244,  6) MHMD5STEP(MHMD5I, d, a, b, c,  7, 0x432aff97, 10) MHMD5STEP(MHMD5I, c, d, a, b, 14, 0xab9423a7, 15) MHMD5STEP(MHMD5I, b, c, d, a,  5, 0xfc93a039, 21) \
+		MHMD5STEP(MHMD5I, a, b, c, d, 12, 0x655b59c3,  6) MHMD5STEP(MHMD5I, d, a, b, c,  3, 0x8f0ccc92, 10) MHMD5STEP(MHMD5I, c, d, a, b, 10, 0xffeff47d, 15) MHMD5STEP(MHMD5I, b, c, d, a,  1, 0x85845dd1, 21) \
+		MHMD5STEP(MHMD5I, a, b, c, d,  8, 0x6fa87e4f,  6) MHMD5STEP(MHMD5I, d, a, b, c, 15, 0xfe2ce6e0, 10) MHMD5STEP(MHMD5I, c, d, a, b,  6, 0xa3014314, 15) MHMD5STEP(MHMD5I, b, c, d, a, 13, 0x4e0811a1, 21) \
+		MHMD5STEP(MHMD5I, a, b, c, d,  4, 0xf7537e82,  6) MHMD5STEP(MHMD5I, d, a, b, c, 11, 0xbd3af235, 10) MHMD5STEP(MHMD5I, c, d, a, b,  2, 0x2ad7d2bb, 15) MHMD5STEP(MHMD5I, b, c, d, a,  9, 0xeb86d391, 21) \
+		MHSTORE(state[0], MHADD(a, sa)); MHSTORE(state[1], MHADD(b, sb)); MHSTORE(state[2], MHADD(c, sc)); MHSTORE(state[3], MHADD(d, sd));
+
+	#define MHSHA1F0(x, y, z) MHXOR(z, MHAND(x, MHXOR(y, z)))
+	#define MHSHA1F1(x, y, z) MHXOR(MHXOR(x, y), z)
+	#define MHSHA1F2(x, y, z) MHOR(MHAND(MHOR(x, y), z), MHAND(x, y))
+	#define MHSHA1W(i) ((i) < 16 ? m[(i) & 15] : (m[(i) & 15] = MHROL(MHXOR(MHXOR(m[((i) + 13) & 15], m[((i) + 8) & 15]), MHXOR(m[((i) + 2) & 15], m[(i) & 15])), 1)))
+	#define MHSHA1STEP(v, w, x, y, z, f, k, i) z = MHADD(MHADD(z, f(w, x, y)), MHADD(MHADD(MHSHA1W(i), MHSET1(k)), MHROL(v, 5))); w = MHROL(w, 30);
+	#define MHSHA1STEP5(f, k, i) MHSHA1STEP(a, b, c, d, e, f, k, i) MHSHA1STEP(e, a, b, c, d, f, k, i + 1) MHSHA1STEP(d, e, a, b, c, f, k, i + 2) MHSHA1STEP(c, d, e, a, b, f, k, i + 3) MHSHA1STEP(b, c, d, e, a, f, k, i + 4)
+	#define MHSHA1BODY \
+		MHV m[16], a = MHLOAD(state[0]), b = MHLOAD(state[1]), c = MHLOAD(state[2]), d = MHLOAD(state[3]), e = MHLOAD(state[4]), sa = a, sb = b, sc = c, sd = d, se = e; \
+		MHLOADMSG(m, MHBSWAP) \
+		MHSHA1STEP5(MHSHA1F0, 0x5A827999,  0) MHSHA1STEP5(MHSHA1F0, 0x5A827999,  5) MHSHA1STEP5(MHSHA1F0, 0x5A827999, 10) MHSHA1STEP5(MHSHA1F0, 0x5A827999, 15) \
+		MHSHA1STEP5(MHSHA1F1, 0x6ED9EBA1, 20) MHSHA1STEP5(MHSHA1F1, 0x6ED9EBA1, 25) MHSHA1STEP5(MHSHA1F1, 0x6ED9EBA1, 30) MHSHA1STEP5(MHSHA1F1, 0x6ED9EBA1, 35) \
+		MHSHA1STEP5(MHSHA1F2, 0x8F1BBCDC, 40) MHSHA1STEP5(MHSHA1F2, 0x8F1BBCDC, 45) MHSHA1STEP5(MHSHA1F2, 0x8F1BBCDC, 50) MHSHA1STEP5(MHSHA1F2, 0x8F1BBCDC, 55) \
+		MHSHA1STEP5(MHSHA1F1, 0xCA62C1D6, 60) MHSHA1STEP5(MHSHA1F1, 0xCA62C1D6, 65) MHSHA1STEP5(MHSHA1F1, 0xCA62C1D6, 70) MHSHA1STEP5(MHSHA1F1, 0xCA62C1D6, 75) \
+		MHSTORE(state[0], MHADD(a, sa)); MHSTORE(state[1], MHADD(b, sb)); MHSTORE(state[2], MHADD(c, sc)); MHSTORE(state[3], MHADD(d, sd)); MHSTORE(state[4], MHADD(e, se));
+
+	#define MHV __m128i
+	#define MHADD _mm_add_epi32
+	#define MHXOR _mm_xor_si128
+	#define MHAND _mm_and_si128
+	#define MHOR _mm_or_si128
+	#define MHSLL _mm_slli_epi32
+	#define MHSRL _mm_srli_epi32
+	#define MHSET1(c) _mm_set1_epi32((int)(c))
+	#define MHLOAD(p) _mm_loadu_si128((const __m128i*)(p))
+	#define MHSTORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+	#define MHROW(l, q) _mm_loadu_si128((const __m128i*)(blocks[l] + (q) * 16))
+	#define MHUNPLO32 _mm_unpacklo_epi32
+	#define MHUNPHI32 _mm_unpackhi_epi32
+	#define MHUNPLO64 _mm_unpacklo_epi64
+	#define MHUNPHI64 _mm_unpackhi_epi64
+	#define MHBSWAP(x) MHBSWAP_SSE2(x)
+	CHDTOOGG_TARGET("sse2") static inline __m128i MHBSWAP_SSE2(__m128i x)
+	{
+		__m128i t = _mm_or_si128(_mm_slli_epi32(x, 24), _mm_srli_epi32(x, 24)), m = _mm_set1_epi32(0xFF00);
+		return _mm_or_si128(t, _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, m), 8), _mm_and_si128(_mm_srli_epi32(x, 8), m)));
+	}
+	CHDTOOGG_TARGET("sse2") static void MD5x4(Bit32u state[][MAX_LANES], const Bit8u* const blocks[MAX_LANES]) { MHMD5BODY }
+	CHDTOOGG_TARGET("sse2") static void SHA1x4(Bit32u state[][MAX_LANES], const Bit8u* const blocks[MAX_LANES]) { MHSHA1BODY }
+	#undef MHV
+	#undef MHADD
+	#undef MHXOR
+	#undef MHAND
+	#undef MHOR
+	#undef MHSLL
+	#undef MHSRL
+	#undef MHSET1
+	#undef MHLOAD
+	#undef MHSTORE
+	#undef MHROW
+	#undef MHUNPLO32
+	#undef MHUNPHI32
+	#undef MHUNPLO64
+	#undef MHUNPHI64
+	#undef MHBSWAP
+
+	#define MHV __m256i
+	#define MHADD _mm256_add_epi32
+	#define MHXOR _mm256_xor_si256
+	#define MHAND _mm256_and_si256
+	#define MHOR _mm256_or_si256
+	#define MHSLL _mm256_slli_epi32
+	#define MHSRL _mm256_srli_epi32
+	#define MHSET1(c) _mm256_set1_epi32((int)(c))
+	#define MHLOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+	#define MHSTORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+	#define MHROW(l, q) _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(blocks[l] + (q) * 16))), _mm_loadu_si128((const __m128i*)(blocks[(l) + 4] + (q) * 16)), 1)
+	#define MHUNPLO32 _mm256_unpacklo_epi32 // the unpack instructions work within the 128-bit halves which hold lanes 0 to 3 and 4 to 7
+	#define MHUNPHI32 _mm256_unpackhi_epi32
+	#define MHUNPLO64 _mm256_unpacklo_epi64
+	#define MHUNPHI64 _mm256_unpackhi_epi64
+	#define MHBSWAP(x) _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3))
+	CHDTOOGG_TARGET("avx2") static void MD5x8(Bit32u state[][MAX_LANES], const Bit8u* const blocks[MAX_LANES]) { MHMD5BODY }
+	CHDTOOGG_TARGET("avx2") static void SHA1x8(Bit32u state[][MAX_LANES], const Bit8u* const blocks[MAX_LANES]) { MHSHA1BODY }
+	#undef MHV
+	#undef MHADD
+	#undef MHXOR
+	#undef MHAND
+	#undef MHOR
+	#undef MHSLL
+	#undef MHSRL
+	#undef MHSET1
+	#undef MHLOAD
+	#undef MHSTORE
+	#undef MHROW
+	#undef MHUNPLO32
+	#undef MHUNPHI32
+	#undef MHUNPLO64
+	#undef MHUNPHI64
+	#undef MHBSWAP
+	#endif
+};
+
+static void HashMulti(HashJob* jobs, size_t num)
+{
+	MultiHashImpl::Get().Run(jobs, num);
+}
+
+#ifdef CHDTOOGG_WORKERS
+// Threads which calculate the source hashes for the XML metadata while tracks are still being read and encoded, buffers which are
+// waiting get hashed together in SIMD lanes
+struct HashPool
+{
+	enum { THREADS = 2 };
+	struct Buffer { HashJob job; bool done; };
+	std::vector<Buffer*> buffers;
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool quit;
+
+	HashPool() : quit(false) { }
+
+	~HashPool()
+	{
+		{ std::lock_guard<std::mutex> lock(mtx); quit = true; }
+		cv.notify_all();
+		for (size_t i = 0; i != threads.size(); i++) threads[i].join();
+	}
+
+	void Start()
+	{
+		for (int i = 0; i != THREADS; i++) threads.push_back(std::thread(ThreadMain, this));
 	}
-	free(chd_hunkmap);
-	chd_hunkmap = NULL;
 
-	if (showXML)
+	void Add(Buffer* b)
 	{
-		fprintf(stderr, "\nPrinting XML elements to standard output ...\n---------------------------------------------------------------------------\n");
-		for (size_t itrk = 0; itrk != cueTracks.size(); itrk++)
-			if (xmlTracks[itrk].size()) printf("%s", &xmlTracks[itrk][0]);
-		fprintf(stderr, "---------------------------------------------------------------------------\nDone!\n");
+		std::lock_guard<std::mutex> lock(mtx);
+		b->done = false;
+		buffers.push_back(b);
+		cv.notify_all();
 	}
 
-	fprintf(stderr, "\nFinished processing all tracks, writing CUE file %s ...\n", outPathCUE);
-	for (size_t itrk = 0; itrk != cueTracks.size(); itrk++)
+	void Wait(Buffer* b)
 	{
-		if (!cueTracks[itrk].size()) { fprintf(stderr, "Error: CHD misses track %u (but has track %u)\n\n", (unsigned)(itrk + 1), (unsigned)(itrk + 2)); goto chderr; }
-		fwrite(&cueTracks[itrk][0], strlen(&cueTracks[itrk][0]), 1, fCUE);
+		std::unique_lock<std::mutex> lock(mtx);
+		while (!b->done) cv.wait(lock);
 	}
-	fprintf(stderr, "Done!\n");
-	return 0;
+
+	static void ThreadMain(HashPool* pool)
+	{
+		std::unique_lock<std::mutex> lock(pool->mtx);
+		for (;;)
+		{
+			if (!pool->buffers.empty())
+			{
+				HashJob jobs[MultiHashImpl::MAX_LANES];
+				Buffer* taken[MultiHashImpl::MAX_LANES];
+				size_t num = 0;
+				for (; num != MultiHashImpl::MAX_LANES && !pool->buffers.empty(); num++)
+				{
+					taken[num] = pool->buffers.front();
+					pool->buffers.erase(pool->buffers.begin());
+					jobs[num] = taken[num]->job;
+				}
+				lock.unlock();
+				HashMulti(jobs, num);
+				lock.lock();
+				for (size_t i = 0; i != num; i++) { taken[i]->job.res = jobs[i].res; taken[i]->done = true; }
+				pool->cv.notify_all();
+			}
+			else if (pool->quit) return;
+			else pool->cv.wait(lock);
+		}
+	}
+};
+#endif
+
+// Snapshots of a long encode which is written directly to the track file, with --checkpoint an interrupted encode continues from the last one.
+// The checkpoint file next to the temporary track file stores the encoder state with the number of PCM bytes fed and Ogg bytes written when it was taken.
+struct EncodeCheckpoint
+{
+	std::string path, key; // key identifies the CHD file, the settings and the track
+	Bit64u every, next, pcmPos, romlen; // pcmPos and romlen are where the loaded state continues
+	std::vector<Bit8u> state; // empty if no checkpoint was loaded
+	struct Encode* enc;
+
+	void Fed(size_t bytes)
+	{
+		if ((pcmPos += bytes) < next) return;
+		next = pcmPos + every;
+		WasmEncodeVorbisCheckpoint((fnEncodeVorbisCheckpoint)Write, this);
+	}
+
+	FILE* Open(const std::string& pathTemp);
+	bool Resume(int quality, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data, size_t& feedPos);
+	void Discard(FILE* fOut);
+	static void Write(const void* state, uint32_t len, EncodeCheckpoint* self);
+};
+
+struct Encode
+{
+	size_t wavpcmlen, wavpcmpos, romcap, romlen;
+	Bit8u *wavpcm, *rombuf;
+	FILE* fOut; // if set the output is written to the file directly instead of into rombuf and romlen only counts the bytes
+	HashCtx* hash; // if set the output gets hashed while it is being written
+	EncodeCheckpoint* ckpt; // if set the encode takes checkpoints
+
+	static uint32_t FeedSamples(float* bufL, float* bufR, uint32_t num, Encode* self)
+	{
+		uint32_t remain = (uint32_t)((self->wavpcmlen - self->wavpcmpos) / 4);
+		if (remain < num) num = remain;
+		ConvertSamples(bufL, bufR, num, self->wavpcm + self->wavpcmpos);
+		if (!self->wavpcmpos && self->wavpcmlen >= 1024*1024) { fprintf(stderr, "  Progress: 0%%"); fflush(stderr); }
+		self->wavpcmpos += num * 4;
+		if ((self->wavpcmpos / (1024*1024)) != ((self->wavpcmpos - (num * 4)) / (1024*1024))) { fprintf(stderr, " .. %u%%", (uint32_t)(((uint64_t)self->wavpcmpos * 100 + 50) / self->wavpcmlen)); fflush(stderr); }
+		if (self->wavpcmpos == self->wavpcmlen && self->wavpcmlen >= 1024*1024 && num) fprintf(stderr, "\n");
+		if (self->ckpt) self->ckpt->Fed(num * 4);
+		return num;
+	}
+	static void OggOutput(const void* data, uint32_t len, Encode* self)
+	{
+		if (self->hash) self->hash->Update(data, len);
+		if (self->fOut) fwrite(data, len, 1, self->fOut);
+		else
+		{
+			while (self->romlen + len > self->romcap) self->rombuf = (Bit8u*)realloc(self->rombuf, (self->romcap += 1024*1024));
+			memcpy(self->rombuf + self->romlen, data, len);
+		}
+		self->romlen += len;
+	}
+	// Append a separately encoded Ogg stream as the next link of a chained Ogg file, the serial number of each link needs to be unique.
+	// The pages get modified in place before they are appended so the output only ever receives final data.
+	static void AppendChained(Encode* self, Bit8u* ogg, size_t len, Bit32u serialno)
+	{
+		for (size_t pos = 0, page_len; pos + 27 <= len; pos += page_len)
+		{
+			Bit8u* page = ogg + pos;
+			page_len = 27 + page[26];
+			for (int i = 0; i != page[26]; i++) page_len += page[27 + i];
+			page[14] = (Bit8u)serialno; page[15] = (Bit8u)(serialno >> 8); page[16] = (Bit8u)(serialno >> 16); page[17] = (Bit8u)(serialno >> 24);
+			memset(page + 22, 0, 4);
+			Bit32u crc = OggCRC32(page, page_len);
+			page[22] = (Bit8u)crc; page[23] = (Bit8u)(crc >> 8); page[24] = (Bit8u)(crc >> 16); page[25] = (Bit8u)(crc >> 24);
+		}
+		OggOutput(ogg, (uint32_t)len, self);
+	}
+	static void ConvertSamples(float* bufL, float* bufR, uint32_t num, const Bit8u* wavpcm)
+	{
+		const signed char* pcm = (const signed char*)wavpcm;
+		for (uint32_t i = 0; i != num; i++, pcm += 4)
+		{
+			bufL[i] = ((pcm[1] << 8) | (0x00ff & (int)pcm[0])) / 32768.f;
+			bufR[i] = ((pcm[3] << 8) | (0x00ff & (int)pcm[2])) / 32768.f;
+		}
+	}
+};
+
+#ifdef CHDTOOGG_WORKERS
+// CPU topology used to place the worker processes, read from sysfs on Linux. Each domain is a group of CPUs sharing an L3 cache
+// (or a socket if the cache isn't listed). The first hardware thread of every core comes before the SMT siblings in its list.
+struct CpuTopology
+{
+	struct Domain { std::string key; std::vector<int> cpus; size_t cores; Bit64u l3Bytes; };
+	std::vector<Domain> domains;
+
+	void Load()
+	{
+		#ifdef __linux__
+		cpu_set_t allowed;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+		std::vector< std::pair<size_t, int> > siblings; // domain and CPU of SMT siblings
+		for (int cpu = 0; cpu != CPU_SETSIZE; cpu++)
+		{
+			if (!CPU_ISSET(cpu, &allowed)) continue;
+			char base[64];
+			sprintf(base, "/sys/devices/system/cpu/cpu%d/", cpu);
+			std::string key, sizeStr, thread = ReadLine(std::string(base) + "topology/thread_siblings_list");
+			for (int idx = 0; idx != 8 && key.empty(); idx++)
+			{
+				char cache[96];
+				sprintf(cache, "%scache/index%d/", base, idx);
+				if (ReadLine(std::string(cache) + "level") != "3") continue;
+				key = "L3 " + ReadLine(std::string(cache) + "shared_cpu_list");
+				sizeStr = ReadLine(std::string(cache) + "size");
+			}
+			if (key.empty()) key = "socket " + ReadLine(std::string(base) + "topology/physical_package_id");
+			size_t id = 0;
+			while (id != domains.size() && domains[id].key != key) id++;
+			if (id == domains.size())
+			{
+				Domain d;
+				d.key = key;
+				d.cores = 0;
+				d.l3Bytes = (Bit64u)atoi(sizeStr.c_str()) * (strchr(sizeStr.c_str(), 'M') ? 1024*1024 : strchr(sizeStr.c_str(), 'K') ? 1024 : 1);
+				domains.push_back(d);
+			}
+			if (!thread.empty() && atoi(thread.c_str()) != cpu) { siblings.push_back(std::make_pair(id, cpu)); continue; }
+			domains[id].cpus.push_back(cpu);
+			domains[id].cores++;
+		}
+		for (size_t i = 0; i != siblings.size(); i++) domains[siblings[i].first].cpus.push_back(siblings[i].second);
+		#endif
+	}
+
+	// How many encoders can run in a domain without their working sets pushing each other out of the L3 cache, at most one per core
+	size_t Limit(const Domain& d, Bit64u workingSet) const
+	{
+		size_t fit = (d.l3Bytes && workingSet ? (size_t)(d.l3Bytes / workingSet) : d.cores);
+		return (fit < 1 ? 1 : fit > d.cores ? d.cores : fit);
+	}
+
+	size_t Slots(Bit64u workingSet) const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i != domains.size(); i++) n += Limit(domains[i], workingSet);
+		return n;
+	}
+
+	// Picks a CPU for each worker, taking turns between the domains. The first pass fills them up to their limits, the second one uses
+	// their remaining CPUs. Leaves cpus empty if there are more workers than CPUs, those are better left to the scheduler.
+	void Place(size_t count, Bit64u workingSet, std::vector<int>& cpus) const
+	{
+		for (int pass = 0; pass != 2; pass++)
+			for (size_t round = 0, any = 1; any; round++)
+			{
+				any = 0;
+				for (size_t i = 0; i != domains.size() && cpus.size() != count; i++)
+				{
+					size_t limit = Limit(domains[i], workingSet), pos = (pass ? limit : 0) + round;
+					if (pos < (pass ? domains[i].cpus.size() : limit)) { cpus.push_back(domains[i].cpus[pos]); any = 1; }
+				}
+			}
+		if (cpus.size() != count) cpus.clear();
+	}
+
+	static std::string ReadLine(const std::string& path)
+	{
+		char line[256] = "";
+		FILE* f = fopen(path.c_str(), "r");
+		if (f) { if (!fgets(line, sizeof(line), f)) line[0] = '\0'; fclose(f); }
+		size_t len = strlen(line);
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+		return line;
+	}
+};
+
+// Pool of forked encoder processes. Each worker has its own copy of the static state of the wasm runtime which makes it possible
+// to run multiple encodes at the same time. The parent streams the 16-bit PCM of a track into a shared memory ring buffer and
+// receives the Ogg output over a second one. A worker crashing only fails the track it was encoding.
+struct EncodePool
+{
+	enum { PCM_RING_SIZE = 1024*1024, OGG_RING_SIZE = 256*1024, FEED_MAX = 8192, JOB_EXIT = 0xFFFFFFFF };
+	struct Ring { Bit64u head, tail; Bit32u eof, pad; }; // head and tail are the total number of bytes written and read
+	struct Shared
+	{
+		Bit32u seq; // futex word which gets bumped on every change made by either side
+		Bit32u job, done, quality; // job gets incremented by the parent to start an encode, done gets set to it by the worker when finished
+		Bit32u ready; // set by a pinned worker once it touched the ring buffers
+		pid_t parent;
+		Ring pcm, ogg;
+		Bit8u pcmbuf[PCM_RING_SIZE], oggbuf[OGG_RING_SIZE];
+	};
+	struct Worker { Shared* sh; pid_t pid; Bit32u job; bool busy, dead; };
+	std::vector<Worker> workers;
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	~EncodePool()
+	{
+		for (size_t i = 0; i != workers.size(); i++)
+		{
+			Worker& w = workers[i];
+			if (!w.dead) { __atomic_store_n(&w.sh->job, (Bit32u)JOB_EXIT, __ATOMIC_RELEASE); Signal(w.sh); waitpid(w.pid, NULL, 0); }
+			munmap(w.sh, sizeof(Shared));
+		}
+	}
+
+	// Needs to be called before any other threads are started, each worker gets pinned to its entry in cpus if it isn't empty
+	size_t Start(int count, const std::vector<int>& cpus)
+	{
+		pid_t parent = getpid();
+		for (int i = 0; i < count; i++)
+		{
+			void* mem = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED) break;
+			Worker w = { (Shared*)mem, 0, 0, false, false };
+			w.sh->parent = parent;
+			fflush(stdout); fflush(stderr);
+			if ((w.pid = fork()) == 0)
+			{
+				if ((size_t)i < cpus.size()) Pin(cpus[i], w.sh);
+				WorkerMain(w.sh);
+			}
+			if (w.pid < 0) { munmap(mem, sizeof(Shared)); break; }
+			workers.push_back(w);
+		}
+		for (size_t i = 0; i != workers.size() && !cpus.empty(); i++)
+		{
+			// The parent must not write into the ring buffers before the worker cleared them
+			Shared* sh = workers[i].sh;
+			for (Bit32u seq; !__atomic_load_n(&sh->ready, __ATOMIC_ACQUIRE);)
+			{
+				seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&sh->ready, __ATOMIC_ACQUIRE)) break;
+				FutexWait(&sh->seq, seq, 100);
+				if (waitpid(workers[i].pid, NULL, WNOHANG) == workers[i].pid) { workers[i].dead = true; break; }
+			}
+		}
+		return workers.size();
+	}
+
+	// Encode PCM data on a free worker (blocks until one is available), returns false if the worker crashed
+	bool Run(int quality, const Bit8u* wavpcm, size_t wavpcmlen, fnEncodeVorbisOutput outpt, void* user_data)
+	{
+		Worker* w = NULL;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			for (;;)
+			{
+				bool alive = false;
+				for (size_t i = 0; i != workers.size() && !w; i++)
+					if (!workers[i].dead) { alive = true; if (!workers[i].busy) w = &workers[i]; }
+				if (w || !alive) break;
+				cv.wait(lock);
+			}
+			if (!w) return false;
+			w->busy = true;
+		}
+
+		Shared* sh = w->sh;
+		memset(&sh->pcm, 0, sizeof(sh->pcm));
+		memset(&sh->ogg, 0, sizeof(sh->ogg));
+		sh->quality = (Bit32u)quality;
+		Bit32u job = ++w->job;
+		__atomic_store_n(&sh->job, job, __ATOMIC_RELEASE);
+		Signal(sh);
+
+		bool ok = true;
+		for (size_t pcmpos = 0;;)
+		{
+			Bit32u seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+			bool progress = false;
+			size_t space = (size_t)(PCM_RING_SIZE - (sh->pcm.head - __atomic_load_n(&sh->pcm.tail, __ATOMIC_ACQUIRE)));
+			if (pcmpos != wavpcmlen && space)
+			{
+				size_t n = (wavpcmlen - pcmpos < space ? wavpcmlen - pcmpos : space);
+				RingWrite(sh->pcmbuf, PCM_RING_SIZE, sh->pcm.head, wavpcm + pcmpos, n);
+				__atomic_store_n(&sh->pcm.head, sh->pcm.head + n, __ATOMIC_RELEASE);
+				pcmpos += n;
+				progress = true;
+			}
+			if (pcmpos == wavpcmlen && !sh->pcm.eof) { __atomic_store_n(&sh->pcm.eof, 1, __ATOMIC_RELEASE); progress = true; }
+			for (Bit64u head = __atomic_load_n(&sh->ogg.head, __ATOMIC_ACQUIRE); sh->ogg.tail != head; progress = true)
+			{
+				size_t ofs = (size_t)(sh->ogg.tail % OGG_RING_SIZE), n = (size_t)(head - sh->ogg.tail);
+				if (n > OGG_RING_SIZE - ofs) n = OGG_RING_SIZE - ofs;
+				outpt(sh->oggbuf + ofs, (uint32_t)n, user_data);
+				__atomic_store_n(&sh->ogg.tail, sh->ogg.tail + n, __ATOMIC_RELEASE);
+			}
+			if (progress) { Signal(sh); continue; }
+			if (__atomic_load_n(&sh->done, __ATOMIC_ACQUIRE) == job && __atomic_load_n(&sh->ogg.head, __ATOMIC_ACQUIRE) == sh->ogg.tail) break;
+			FutexWait(&sh->seq, seq, 100);
+			if (waitpid(w->pid, NULL, WNOHANG) == w->pid) { ok = false; break; }
+		}
+
+		std::lock_guard<std::mutex> lock(mtx);
+		w->busy = false;
+		w->dead = !ok;
+		cv.notify_all();
+		return ok;
+	}
+
+	// Memory gets allocated on the NUMA node of the CPU which first writes to it, so after pinning the worker touches the ring buffers
+	// itself. The linear memory of its encoder is copied on write from the parent and so also ends up on the local node.
+	static void Pin(int cpu, Shared* sh)
+	{
+		#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (!sched_setaffinity(0, sizeof(set), &set))
+		{
+			memset(sh->pcmbuf, 0, sizeof(sh->pcmbuf));
+			memset(sh->oggbuf, 0, sizeof(sh->oggbuf));
+		}
+		#endif
+		__atomic_store_n(&sh->ready, 1, __ATOMIC_RELEASE);
+		Signal(sh);
+	}
+
+	static void WorkerMain(Shared* sh)
+	{
+		#ifdef __linux__
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		#endif
+		for (Bit32u job = 0;;)
+		{
+			Bit32u seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE), newjob = __atomic_load_n(&sh->job, __ATOMIC_ACQUIRE);
+			if (newjob == JOB_EXIT) _exit(0);
+			if (newjob == job) { WorkerWait(sh, seq); continue; }
+			WasmEncodeVorbis((int)sh->quality, (fnEncodeVorbisFeedSamples)WorkerFeedSamples, (fnEncodeVorbisOutput)WorkerOggOutput, sh);
+			__atomic_store_n(&sh->done, (job = newjob), __ATOMIC_RELEASE);
+			Signal(sh);
+		}
+	}
+
+	static uint32_t WorkerFeedSamples(float* bufL, float* bufR, uint32_t num, Shared* sh)
+	{
+		// Wait until the requested number of samples is available (or the end of the track) to feed the encoder exactly like a non-worker encode
+		Bit8u tmp[FEED_MAX * 4];
+		if (num > FEED_MAX) num = FEED_MAX;
+		size_t avail;
+		for (;;)
+		{
+			Bit32u seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE), eof = __atomic_load_n(&sh->pcm.eof, __ATOMIC_ACQUIRE);
+			avail = (size_t)(__atomic_load_n(&sh->pcm.head, __ATOMIC_ACQUIRE) - sh->pcm.tail);
+			if (avail >= num * 4 || eof) break;
+			WorkerWait(sh, seq);
+		}
+		if (num > avail / 4) num = (uint32_t)(avail / 4);
+		RingRead(tmp, sh->pcmbuf, PCM_RING_SIZE, sh->pcm.tail, num * 4);
+		__atomic_store_n(&sh->pcm.tail, sh->pcm.tail + num * 4, __ATOMIC_RELEASE);
+		Signal(sh);
+		Encode::ConvertSamples(bufL, bufR, num, tmp);
+		return num;
+	}
+
+	static void WorkerOggOutput(const void* data, uint32_t len, Shared* sh)
+	{
+		for (const Bit8u* p = (const Bit8u*)data; len;)
+		{
+			Bit32u seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+			size_t space = (size_t)(OGG_RING_SIZE - (sh->ogg.head - __atomic_load_n(&sh->ogg.tail, __ATOMIC_ACQUIRE)));
+			if (!space) { WorkerWait(sh, seq); continue; }
+			size_t n = (len < space ? len : space);
+			RingWrite(sh->oggbuf, OGG_RING_SIZE, sh->ogg.head, p, n);
+			__atomic_store_n(&sh->ogg.head, sh->ogg.head + n, __ATOMIC_RELEASE);
+			Signal(sh);
+			p += n;
+			len -= (uint32_t)n;
+		}
+	}
+
+	static void WorkerWait(Shared* sh, Bit32u seq)
+	{
+		FutexWait(&sh->seq, seq, 1000);
+		if (getppid() != sh->parent) _exit(1); // parent process is gone
+	}
+
+	static void RingWrite(Bit8u* ring, size_t ringsize, Bit64u head, const Bit8u* src, size_t n)
+	{
+		size_t ofs = (size_t)(head % ringsize), first = (n < ringsize - ofs ? n : ringsize - ofs);
+		memcpy(ring + ofs, src, first);
+		memcpy(ring, src + first, n - first);
+	}
+
+	static void RingRead(Bit8u* dst, const Bit8u* ring, size_t ringsize, Bit64u tail, size_t n)
+	{
+		size_t ofs = (size_t)(tail % ringsize), first = (n < ringsize - ofs ? n : ringsize - ofs);
+		memcpy(dst, ring + ofs, first);
+		memcpy(dst + first, ring, n - first);
+	}
+
+	static void Signal(Shared* sh)
+	{
+		__atomic_fetch_add(&sh->seq, 1, __ATOMIC_RELEASE);
+		#ifdef __linux__
+		syscall(SYS_futex, &sh->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		#endif
+	}
+
+	static void FutexWait(Bit32u* addr, Bit32u val, int timeout_ms)
+	{
+		#ifdef __linux__
+		struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+		syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+		#else // without futex just poll the shared state
+		struct timespec ts = { 0, 200000L };
+		if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val) nanosleep(&ts, NULL);
+		#endif
+	}
+};
+#endif
+
+// Moves a completely written temporary file to its final name, replacing an existing file
+static bool ReplaceFile(const std::string& pathTemp, const std::string& path)
+{
+	#ifdef _WIN32
+	remove(path.c_str()); // rename doesn't replace existing files on Windows
+	#endif
+	if (!rename(pathTemp.c_str(), path.c_str())) return true;
+	fprintf(stderr, "  Error: Unable to rename '%s' to '%s'\n", pathTemp.c_str(), path.c_str());
+	remove(pathTemp.c_str());
+	return false;
+}
+
+static bool TruncateFile(FILE* f, Bit64u size)
+{
+	fflush(f);
+	#ifdef _WIN32
+	return !_chsize_s(_fileno(f), (__int64)size);
+	#else
+	return !ftruncate(fileno(f), (off_t)size);
+	#endif
+}
+
+// Sidecar file next to the CHD which stores the source hashes and silence lengths of its tracks so later runs with -x don't need to calculate them again.
+// The stored data is only used if the SHA-1 in the CHD header and the file size still match.
+struct SourceHashCache
+{
+	struct Entry { int track_no; size_t track_size; Bit32u in_zeros, out_zeros; HashResult res; };
+	std::vector<Entry> entries;
+	std::string path;
+	char key[64];
+	bool dirty;
+
+	void Load(const char* pathCHD, const Bit8u chdsha1[20], Bit64u chd_size)
+	{
+		path.assign(pathCHD).append(".hashcache");
+		MakeKey(key, chdsha1, chd_size);
+		dirty = false;
+		FILE* f = fopen(path.c_str(), "r");
+		if (!f) return;
+		char fkey[64], md5[33], sha1[41];
+		unsigned long long size;
+		Entry e;
+		if (fscanf(f, "CHDtoOGG source hashes %63s", fkey) == 1 && !strcmp(fkey, key))
+			while (fscanf(f, "%d %llu %u %u %x %32s %40s", &e.track_no, &size, &e.in_zeros, &e.out_zeros, &e.res.crc32, md5, sha1) == 7 && ParseHex(md5, e.res.md5, 16) && ParseHex(sha1, e.res.sha1, 20))
+				{ e.track_size = (size_t)size; entries.push_back(e); }
+		fclose(f);
+	}
+
+	const Entry* Find(int track_no, size_t track_size) const
+	{
+		for (size_t i = 0; i != entries.size(); i++)
+			if (entries[i].track_no == track_no && entries[i].track_size == track_size) return &entries[i];
+		return NULL;
+	}
+
+	void Add(int track_no, size_t track_size, Bit32u in_zeros, Bit32u out_zeros, const HashResult& res)
+	{
+		Entry e = { track_no, track_size, in_zeros, out_zeros, res };
+		size_t i = 0;
+		while (i != entries.size() && entries[i].track_no != track_no) i++;
+		if (i == entries.size()) entries.push_back(e);
+		else entries[i] = e;
+		dirty = true;
+	}
+
+	void Save()
+	{
+		if (!dirty) return;
+		FILE* f = fopen(path.c_str(), "w");
+		if (!f) { fprintf(stderr, "Warning: Unable to write hash cache file '%s'\n", path.c_str()); return; }
+		fprintf(f, "CHDtoOGG source hashes %s\n", key);
+		for (size_t i = 0; i != entries.size(); i++)
+		{
+			const Entry& e = entries[i];
+			fprintf(f, "%d %llu %u %u %08x ", e.track_no, (unsigned long long)e.track_size, e.in_zeros, e.out_zeros, e.res.crc32);
+			for (int j = 0; j != 16; j++) fprintf(f, "%02x", e.res.md5[j]);
+			fprintf(f, " ");
+			for (int j = 0; j != 20; j++) fprintf(f, "%02x", e.res.sha1[j]);
+			fprintf(f, "\n");
+		}
+		fclose(f);
+		dirty = false;
+	}
+
+	// Identifies the content of a CHD file by the SHA-1 in its header and the file size
+	static void MakeKey(char key[64], const Bit8u chdsha1[20], Bit64u chd_size)
+	{
+		for (int i = 0; i != 20; i++) key += sprintf(key, "%02x", chdsha1[i]);
+		sprintf(key, ":%llu", (unsigned long long)chd_size);
+	}
+
+	static bool ParseHex(const char* str, Bit8u* out, size_t len)
+	{
+		if (strlen(str) != len * 2) return false;
+		for (size_t i = 0; i != len * 2; i++)
+		{
+			char c = str[i];
+			int v = (c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1);
+			if (v < 0) return false;
+			out[i / 2] = (Bit8u)((i & 1) ? (out[i / 2] | v) : (v << 4));
+		}
+		return true;
+	}
+};
+
+// Manifest file next to a CUE file which lists the track files written for it together with their size, modification time and hashes.
+// With --update, track files which are still unchanged since they were written for the same CHD file and settings are not converted again.
+struct OutputManifest
+{
+	struct Entry { int track_no; std::string settings; Bit64u size; long long mtime; unsigned segments; HashResult res; };
+	std::vector<Entry> entries, old; // old is what was loaded from the last run
+	std::string path, header;
+
+	// The header identifies the CHD file, the entries are only used if it matches
+	void Load(const std::string& pathCUE, const char* chdKey, bool readFile)
+	{
+		char hdr[160];
+		sprintf(hdr, "CHDtoOGG manifest v%s %s", CHDTOOGG_VERSION, chdKey);
+		path.assign(pathCUE).append(".manifest");
+		header.assign(hdr);
+		FILE* f = (readFile ? fopen(path.c_str(), "r") : NULL);
+		if (!f) return;
+		char line[256];
+		Entry e;
+		if (fgets(line, sizeof(line), f) && !strncmp(line, hdr, header.size()) && (line[header.size()] == '\n' || line[header.size()] == '\r'))
+			while (fgets(line, sizeof(line), f) && ParseEntry(line, e)) old.push_back(e);
+		fclose(f);
+	}
+
+	// Each entry lists only the settings its track file depends on, so changing the quality keeps data tracks and changing -n keeps audio tracks
+	static std::string Settings(bool isAudio, int quality, int segmentSecs, bool noData)
+	{
+		char buf[48];
+		if (isAudio) sprintf(buf, "quality=%d,segment=%d", quality, (segmentSecs > 0 ? segmentSecs : 0));
+		else sprintf(buf, "nodata=%d", (noData ? 1 : 0));
+		return buf;
+	}
+
+	// Returns the entry of the last run if it was written with the same settings and the track file still has the same size and modification time
+	const Entry* Unchanged(int track_no, const std::string& settings, const std::string& pathTrack) const
+	{
+		struct stat st;
+		for (size_t i = 0; i != old.size(); i++)
+			if (old[i].track_no == track_no && old[i].settings == settings)
+				return (!stat(pathTrack.c_str(), &st) && (Bit64u)st.st_size == old[i].size && (long long)st.st_mtime == old[i].mtime ? &old[i] : NULL);
+		return NULL;
+	}
+
+	static bool MakeEntry(int track_no, const std::string& settings, const std::string& pathTrack, unsigned segments, const HashResult& res, Entry& e)
+	{
+		struct stat st;
+		if (stat(pathTrack.c_str(), &st)) return false;
+		Entry ne = { track_no, settings, (Bit64u)st.st_size, (long long)st.st_mtime, segments, res };
+		e = ne;
+		return true;
+	}
+
+	static void PrintEntry(FILE* f, const Entry& e)
+	{
+		fprintf(f, "%d %s %llu %lld %u %08x ", e.track_no, e.settings.c_str(), (unsigned long long)e.size, e.mtime, e.segments, e.res.crc32);
+		for (int j = 0; j != 16; j++) fprintf(f, "%02x", e.res.md5[j]);
+		fprintf(f, " ");
+		for (int j = 0; j != 20; j++) fprintf(f, "%02x", e.res.sha1[j]);
+		fprintf(f, "\n");
+	}
+
+	static bool ParseEntry(const char* str, Entry& e)
+	{
+		char settings[48], md5[33], sha1[41];
+		unsigned long long size;
+		if (sscanf(str, "%d %47s %llu %lld %u %x %32s %40s", &e.track_no, settings, &size, &e.mtime, &e.segments, &e.res.crc32, md5, sha1) != 8) return false;
+		e.settings.assign(settings);
+		e.size = size;
+		return SourceHashCache::ParseHex(md5, e.res.md5, 16) && SourceHashCache::ParseHex(sha1, e.res.sha1, 20);
+	}
+
+	void Save()
+	{
+		FILE* f = fopen(path.c_str(), "w");
+		if (!f) { fprintf(stderr, "Warning: Unable to write manifest file '%s'\n", path.c_str()); return; }
+		fprintf(f, "%s\n", header.c_str());
+		for (size_t i = 0; i != entries.size(); i++) PrintEntry(f, entries[i]);
+		fclose(f);
+	}
+};
+
+// Append-only journal of the track and CUE files completed with --journal, each record is flushed once its file has been renamed to the final name.
+// After a crash, the tracks listed for the same CHD file and settings are kept like unchanged tracks with --update, so the conversion resumes with the first incomplete track.
+struct Journal
+{
+	struct Set { std::string pathCUE, header; std::vector<OutputManifest::Entry> entries; bool done; };
+	std::vector<Set> sets;
+	std::string path;
+	FILE* f;
+
+	bool Open(const char* pathJournal)
+	{
+		path.assign(pathJournal);
+		if ((f = fopen(pathJournal, "r")) != NULL)
+		{
+			char line[8192];
+			OutputManifest::Entry e;
+			while (fgets(line, sizeof(line), f))
+			{
+				char *pathCUE = strchr(line, '\t'), *end = strchr(line, '\n'), *arg;
+				if (!pathCUE || !end) continue; // a record cut off by a crash
+				*(pathCUE++) = *end = '\0';
+				if ((arg = strchr(pathCUE, '\t')) != NULL) *(arg++) = '\0';
+				Set* set = Find(pathCUE);
+				if (!strcmp(line, "set") && arg)
+				{
+					if (!set) { sets.push_back(Set()); set = &sets.back(); set->pathCUE.assign(pathCUE); set->done = false; }
+					if (set->header != arg) { set->header.assign(arg); set->entries.clear(); set->done = false; }
+				}
+				else if (!strcmp(line, "track") && arg && set && OutputManifest::ParseEntry(arg, e)) set->entries.push_back(e);
+				else if (!strcmp(line, "done") && set) set->done = true;
+			}
+			fclose(f);
+		}
+		if ((f = fopen(pathJournal, "a")) != NULL) return true;
+		fprintf(stderr, "Error: Unable to write journal file '%s'\n\n", pathJournal);
+		return false;
+	}
+
+	Set* Find(const std::string& pathCUE)
+	{
+		for (size_t i = 0; i != sets.size(); i++) if (sets[i].pathCUE == pathCUE) return &sets[i];
+		return NULL;
+	}
+
+	// Whether the CUE file was completed for the same CHD file and still exists
+	bool Completed(const OutputManifest& manifest, const std::string& pathCUE)
+	{
+		struct stat st;
+		Set* set = Find(pathCUE);
+		return (set && set->done && set->header == manifest.header && !stat(pathCUE.c_str(), &st));
+	}
+
+	// Adds the tracks completed for the same CHD file and settings to the entries of the manifest which are checked for unchanged tracks
+	void Resume(OutputManifest& manifest, const std::string& pathCUE)
+	{
+		Set* set = Find(pathCUE);
+		if (set && set->header == manifest.header)
+		{
+			if (set->entries.size()) fprintf(stderr, "Resuming %s with %u completed tracks from the journal\n", pathCUE.c_str(), (unsigned)set->entries.size());
+			manifest.old.insert(manifest.old.begin(), set->entries.begin(), set->entries.end());
+			return;
+		}
+		if (!set) { sets.push_back(Set()); set = &sets.back(); set->pathCUE = pathCUE; }
+		set->header = manifest.header;
+		set->entries.clear();
+		set->done = false;
+		fprintf(f, "set\t%s\t%s\n", pathCUE.c_str(), manifest.header.c_str());
+		fflush(f);
+	}
+
+	// Records a completed track file unless it was already listed when it was kept
+	void Track(const std::string& pathCUE, const OutputManifest::Entry& e)
+	{
+		Set* set = Find(pathCUE);
+		for (size_t i = 0; i != set->entries.size(); i++)
+			if (set->entries[i].track_no == e.track_no && set->entries[i].size == e.size && set->entries[i].mtime == e.mtime) return;
+		set->entries.push_back(e);
+		fprintf(f, "track\t%s\t", pathCUE.c_str());
+		OutputManifest::PrintEntry(f, e);
+		fflush(f);
+	}
+
+	void Done(const std::string& pathCUE)
+	{
+		Set* set = Find(pathCUE);
+		if (set) set->done = true;
+		fprintf(f, "done\t%s\n", pathCUE.c_str());
+		fflush(f);
+	}
+
+	// The journal is only needed until all conversions have been completed
+	void Close(bool completed)
+	{
+		fclose(f);
+		if (completed) remove(path.c_str());
+	}
+};
+
+// Directory of encoded audio tracks named by the SHA-1 of the encoded PCM data and the settings that affect the encoding.
+// Because the encoding is deterministic, identical audio tracks in different CHD files (like regional variants) only get encoded once.
+// Entries are hard links to the track files if possible, otherwise a reflink or a copy.
+struct EncodeCache
+{
+	static void PCMDigest(const Bit8u* pcm, size_t len, char hex[41])
+	{
+		HashCtx ctx;
+		HashResult res;
+		ctx.InitSHA1();
+		ctx.Update(pcm, len);
+		ctx.Final(res);
+		for (int i = 0; i != 20; i++) hex += sprintf(hex, "%02x", res.sha1[i]);
+	}
+
+	static std::string Path(const char* dir, const char* digest, int quality, int segmentSecs)
+	{
+		char name[96];
+		sprintf(name, "%s-q%d-s%d-v%s.ogg", digest, quality, segmentSecs, CHDTOOGG_VERSION);
+		std::string path(dir);
+		if (path.size() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') path += '/';
+		return path.append(name);
+	}
+
+	// Replaces the track file with the cached one, fOut is the just created empty temporary file which gets closed.
+	// The hashes are only calculated if res is set.
+	static bool Fetch(const std::string& cachePath, const std::string& pathTemp, const std::string& pathTrack, FILE*& fOut, Bit64u& size, HashResult* res)
+	{
+		FILE* fIn = fopen(cachePath.c_str(), "rb");
+		if (!fIn) return false;
+		fseek_wrap(fIn, 0, SEEK_END);
+		size = (Bit64u)ftell_wrap(fIn);
+		if (!size) { fclose(fIn); return false; }
+		bool linked = false, copied = false;
+		#ifndef _WIN32
+		std::string tmp(pathTrack + ".link");
+		if (!link(cachePath.c_str(), tmp.c_str()))
+		{
+			if (!rename(tmp.c_str(), pathTrack.c_str())) linked = copied = true;
+			else remove(tmp.c_str());
+		}
+		#endif
+		#ifdef FICLONE
+		if (!copied && !ioctl(fileno(fOut), FICLONE, fileno(fIn))) copied = true;
+		#endif
+		if (!copied || res)
+		{
+			HashCtx hash;
+			hash.Init();
+			std::vector<Bit8u> buf(1024*1024);
+			fseek_wrap(fIn, 0, SEEK_SET);
+			for (size_t n; (n = fread(&buf[0], 1, buf.size(), fIn)) != 0;)
+			{
+				if (res) hash.Update(&buf[0], n);
+				if (!copied) fwrite(&buf[0], n, 1, fOut);
+			}
+			if (res) hash.Final(*res);
+		}
+		fclose(fIn);
+		fclose(fOut);
+		fOut = NULL;
+		if (linked) remove(pathTemp.c_str());
+		else ReplaceFile(pathTemp, pathTrack);
+		return true;
+	}
+
+	// Adds a completely written track file to the cache, copies are made under a temporary name so other processes never see a partial file
+	static void Store(const std::string& pathTrack, const std::string& cachePath)
+	{
+		char tmpSuffix[32];
+		#ifdef _WIN32
+		sprintf(tmpSuffix, ".%d.tmp", _getpid());
+		#else
+		if (!link(pathTrack.c_str(), cachePath.c_str()) || errno == EEXIST) return;
+		sprintf(tmpSuffix, ".%d.tmp", (int)getpid());
+		#endif
+		std::string tmp(cachePath + tmpSuffix);
+		FILE *fIn = fopen(pathTrack.c_str(), "rb"), *fOut = (fIn ? fopen(tmp.c_str(), "wb") : NULL);
+		if (!fOut) { if (fIn) fclose(fIn); fprintf(stderr, "  Warning: Unable to write encode cache file '%s'\n", cachePath.c_str()); return; }
+		bool copied = false;
+		#ifdef FICLONE
+		copied = !ioctl(fileno(fOut), FICLONE, fileno(fIn));
+		#endif
+		if (!copied)
+		{
+			std::vector<Bit8u> buf(1024*1024);
+			for (size_t n; (n = fread(&buf[0], 1, buf.size(), fIn)) != 0;) fwrite(&buf[0], n, 1, fOut);
+		}
+		fclose(fIn);
+		fclose(fOut);
+		if (rename(tmp.c_str(), cachePath.c_str())) remove(tmp.c_str());
+	}
+};
+
+// Opens the temporary track file, it is kept with the output written so far if there is a checkpoint for the same track which can continue it
+FILE* EncodeCheckpoint::Open(const std::string& pathTemp)
+{
+	Bit64u pos[2] = { 0, 0 };
+	struct stat st;
+	char line[256];
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f && fgets(line, sizeof(line), f) && line == key + "\n" && fread(pos, sizeof(pos), 1, f) && !stat(pathTemp.c_str(), &st) && (Bit64u)st.st_size >= pos[1])
+	{
+		Bit64u start = (Bit64u)ftell_wrap(f);
+		fseek_wrap(f, 0, SEEK_END);
+		state.resize((size_t)((Bit64u)ftell_wrap(f) - start));
+		fseek_wrap(f, start, SEEK_SET);
+		if (state.empty() || !fread(&state[0], state.size(), 1, f)) state.clear();
+	}
+	if (f) fclose(f);
+	FILE* fOut = (state.size() ? fopen(pathTemp.c_str(), "r+b") : NULL);
+	if (fOut) { pcmPos = pos[0]; romlen = pos[1]; return fOut; }
+	state.clear();
+	return fopen(pathTemp.c_str(), "wb");
+}
+
+// Continues the encode from the loaded state after cutting the track file back to the output written before it was taken.
+// Returns false if the encode has to start from the beginning instead.
+bool EncodeCheckpoint::Resume(int quality, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data, size_t& feedPos)
+{
+	if (state.empty()) return false;
+	unsigned secs = (unsigned)(pcmPos / (44100 * 4));
+	fprintf(stderr, "  Continuing from checkpoint at %u:%02u\n", secs / 60, secs % 60);
+	bool ok = TruncateFile(enc->fOut, romlen);
+	if (ok && enc->hash)
+	{
+		// The hash of the output so far is calculated again from the track file
+		std::vector<Bit8u> buf(1024*1024);
+		fseek_wrap(enc->fOut, 0, SEEK_SET);
+		for (Bit64u left = romlen, n; ok && left; left -= n)
+		{
+			n = (left < buf.size() ? left : buf.size());
+			ok = (fread(&buf[0], (size_t)n, 1, enc->fOut) == 1);
+			enc->hash->Update(&buf[0], (size_t)n);
+		}
+	}
+	fseek_wrap(enc->fOut, romlen, SEEK_SET);
+	enc->romlen = (size_t)romlen;
+	feedPos = (size_t)pcmPos;
+	next = pcmPos + every;
+	if (ok) ok = !!WasmResumeVorbis(quality, &state[0], (uint32_t)state.size(), feed, outpt, user_data);
+	std::vector<Bit8u>().swap(state);
+	if (ok) return true;
+	fprintf(stderr, "  Warning: Checkpoint could not be used, starting over\n");
+	TruncateFile(enc->fOut, 0);
+	fseek_wrap(enc->fOut, 0, SEEK_SET);
+	if (enc->hash) enc->hash->Init();
+	enc->romlen = 0;
+	feedPos = 0;
+	pcmPos = 0;
+	next = every;
+	return false;
+}
+
+// Drops a loaded checkpoint if the track doesn't get encoded by this process
+void EncodeCheckpoint::Discard(FILE* fOut)
+{
+	if (state.empty()) return;
+	std::vector<Bit8u>().swap(state);
+	TruncateFile(fOut, 0);
+	fseek_wrap(fOut, 0, SEEK_SET);
+}
+
+void EncodeCheckpoint::Write(const void* state, uint32_t len, EncodeCheckpoint* self)
+{
+	// The output written so far needs to be in the track file before a checkpoint refers to it
+	fflush(self->enc->fOut);
+	std::string tmp(self->path + ".tmp");
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (!f) return;
+	Bit64u pos[2] = { self->pcmPos, (Bit64u)self->enc->romlen };
+	fprintf(f, "%s\n", self->key.c_str());
+	bool ok = (fwrite(pos, sizeof(pos), 1, f) && fwrite(state, len, 1, f));
+	if (fclose(f) || !ok) remove(tmp.c_str());
+	else ReplaceFile(tmp, self->path);
+}
+
+// Output files for one quality level
+struct OutputSet
+{
+	int quality;
+	std::string pathCUE, pathBase, pathTemp; // pathBase is the CUE path without extension, used to name the track files, the CUE file is written to pathTemp
+	FILE* fCUE;
+	std::vector< std::vector<char> > cueTracks, xmlTracks;
+	OutputManifest manifest;
+};
+
+// Checks existing output files against the XML DAT metadata printed with -x without running the encoder.
+// The files are hashed by multiple threads, each reading one file at a time in large sequential chunks.
+struct DatVerify
+{
+	struct Rom { std::string name; Bit64u size, actualSize; HashResult res; bool found, match; };
+	struct Source { int track_no; Bit64u size; HashResult res; bool hasZeros, checked; Bit32u in_zeros, out_zeros, trimmed_crc; };
+	std::vector<Rom> roms;
+	std::vector<Source> sources;
+	std::string pathDir;
+	size_t next, numBad;
+
+	bool Load(const char* pathDAT, const char* pathBase, size_t pathDirLen)
+	{
+		FILE* f = fopen(pathDAT, "rb");
+		if (!f) { fprintf(stderr, "Error: Unable to read DAT file '%s'\n\n", pathDAT); return false; }
+		std::string xml;
+		char buf[4096];
+		for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) != 0;) xml.append(buf, n);
+		fclose(f);
+
+		pathDir.assign(pathBase, pathDirLen);
+		numBad = 0;
+		for (size_t pos = 0; (pos = xml.find("<rom ", pos)) != std::string::npos;)
+		{
+			size_t end = xml.find('>', pos);
+			if (end == std::string::npos) break;
+			Rom r;
+			std::string tag(xml, pos, end - pos), size;
+			pos = end;
+			if (!Attr(tag, "name", r.name) || !Attr(tag, "size", size) || !ParseHashes(tag, r.res)) continue;
+			r.size = strtoull(size.c_str(), NULL, 10);
+			r.actualSize = 0;
+			r.found = r.match = false;
+			roms.push_back(r);
+
+			// The nested source element describes the track in the CHD the file was made from
+			size_t posSrc = xml.find('<', end), posTrack = r.name.rfind("(Track ");
+			if (posSrc == std::string::npos || xml.compare(posSrc, 8, "<source ") || posTrack == std::string::npos) continue;
+			Source s;
+			std::string src(xml, posSrc, xml.find('>', posSrc) - posSrc), in_zeros, out_zeros, trimmed_crc;
+			s.track_no = atoi(r.name.c_str() + posTrack + 7);
+			if (!Attr(src, "size", size) || !ParseHashes(src, s.res)) continue;
+			s.size = strtoull(size.c_str(), NULL, 10);
+			s.hasZeros = (Attr(src, "in_zeros", in_zeros) && Attr(src, "out_zeros", out_zeros) && Attr(src, "trimmed_crc", trimmed_crc));
+			s.in_zeros = (Bit32u)strtoul(in_zeros.c_str(), NULL, 10);
+			s.out_zeros = (Bit32u)strtoul(out_zeros.c_str(), NULL, 10);
+			s.trimmed_crc = (Bit32u)strtoul(trimmed_crc.c_str(), NULL, 16);
+			s.checked = false;
+			bool isDuplicate = false; // with multiple quality levels each track is listed once per set
+			for (size_t i = 0; i != sources.size(); i++) isDuplicate |= (sources[i].track_no == s.track_no);
+			if (!isDuplicate) sources.push_back(s);
+		}
+		if (roms.empty()) { fprintf(stderr, "Error: No rom entries found in DAT file '%s'\n\n", pathDAT); return false; }
+		return true;
+	}
+
+	void HashFiles(int threads)
+	{
+		fprintf(stderr, "Verifying %u files ...\n", (unsigned)roms.size());
+		next = 0;
+		#ifdef CHDTOOGG_WORKERS
+		std::vector<std::thread> pool;
+		for (int i = 1; i < threads && (size_t)i < roms.size(); i++) pool.push_back(std::thread(HashThread, this));
+		HashThread(this);
+		for (size_t i = 0; i != pool.size(); i++) pool[i].join();
+		#else
+		HashThread(this);
+		#endif
+
+		for (size_t i = 0; i != roms.size(); i++)
+		{
+			const Rom& r = roms[i];
+			if (!r.found) fprintf(stderr, "  Error: File %s%s is missing\n", pathDir.c_str(), r.name.c_str());
+			else if (r.size != r.actualSize) fprintf(stderr, "  Error: File %s%s has size %llu instead of %llu\n", pathDir.c_str(), r.name.c_str(), (unsigned long long)r.actualSize, (unsigned long long)r.size);
+			else if (!r.match) fprintf(stderr, "  Error: File %s%s has different checksums\n", pathDir.c_str(), r.name.c_str());
+			if (!r.match) numBad++;
+		}
+	}
+
+	static void HashThread(DatVerify* self)
+	{
+		enum { READ_SIZE = 4 * 1024 * 1024 };
+		Bit8u* buf = (Bit8u*)malloc(READ_SIZE);
+		for (;;)
+		{
+			#ifdef CHDTOOGG_WORKERS
+			size_t i = __atomic_fetch_add(&self->next, 1, __ATOMIC_RELAXED);
+			#else
+			size_t i = self->next++;
+			#endif
+			if (i >= self->roms.size()) break;
+			Rom& r = self->roms[i];
+			FILE* f = fopen((self->pathDir + r.name).c_str(), "rb");
+			if (!f) continue;
+			HashCtx ctx;
+			ctx.Init();
+			for (size_t n; (n = fread(buf, 1, READ_SIZE, f)) != 0;) ctx.Update(buf, n);
+			fclose(f);
+			HashResult res;
+			ctx.Final(res);
+			r.found = true;
+			r.actualSize = ctx.size;
+			r.match = (ctx.size == r.size && res.crc32 == r.res.crc32 && !memcmp(res.md5, r.res.md5, 16) && !memcmp(res.sha1, r.res.sha1, 20));
+		}
+		free(buf);
+	}
+
+	void CheckSource(int track_no, size_t track_size, bool isAudio, Bit32u in_zeros, Bit32u out_zeros, const HashResult& res, Bit32u trimmedcrc32)
+	{
+		Source* s = NULL;
+		for (size_t i = 0; i != sources.size(); i++) if (sources[i].track_no == track_no) s = &sources[i];
+		if (!s) { fprintf(stderr, "  Warning: Track %d of the CHD is not listed in the DAT\n", track_no); return; }
+		s->checked = true;
+		bool match = (s->size == track_size && s->res.crc32 == res.crc32 && !memcmp(s->res.md5, res.md5, 16) && !memcmp(s->res.sha1, res.sha1, 20));
+		if (isAudio && s->hasZeros) match &= (s->in_zeros == in_zeros && s->out_zeros == out_zeros && s->trimmed_crc == trimmedcrc32);
+		if (match) return;
+		fprintf(stderr, "  Error: Source of track %d in the CHD does not match the DAT\n", track_no);
+		numBad++;
+	}
+
+	int Finish(bool checkedSources)
+	{
+		for (size_t i = 0; checkedSources && i != sources.size(); i++)
+			if (!sources[i].checked) { fprintf(stderr, "  Error: Track %d listed in the DAT is missing in the CHD\n", sources[i].track_no); numBad++; }
+		if (numBad) { fprintf(stderr, "\nVerification failed with %u mismatches\n\n", (unsigned)numBad); return 1; }
+		fprintf(stderr, "\nAll %u files%s match the DAT\n\n", (unsigned)roms.size(), (checkedSources ? " and source tracks" : ""));
+		return 0;
+	}
+
+	static bool Attr(const std::string& tag, const char* name, std::string& val)
+	{
+		size_t pos = tag.find(std::string(" ") + name + "=\"");
+		if (pos == std::string::npos) return false;
+		pos += strlen(name) + 3;
+		size_t end = tag.find('"', pos);
+		if (end == std::string::npos) return false;
+		val.assign(tag, pos, end - pos);
+		static const char* entities[][2] = { { "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" } };
+		for (size_t posAmp = 0; (posAmp = val.find('&', posAmp)) != std::string::npos; posAmp++)
+			for (int i = 0; i != 5; i++)
+				if (!val.compare(posAmp, strlen(entities[i][0]), entities[i][0])) { val.replace(posAmp, strlen(entities[i][0]), entities[i][1]); break; }
+		return true;
+	}
+
+	static bool ParseHashes(const std::string& tag, HashResult& res)
+	{
+		std::string crc, md5, sha1;
+		if (!Attr(tag, "crc", crc) || !Attr(tag, "md5", md5) || !Attr(tag, "sha1", sha1)) return false;
+		res.crc32 = (Bit32u)strtoul(crc.c_str(), NULL, 16);
+		return SourceHashCache::ParseHex(md5.c_str(), res.md5, 16) && SourceHashCache::ParseHex(sha1.c_str(), res.sha1, 20);
+	}
+};
+
+// Digital silence of an audio track as runs of fully silent sectors plus the exact number of zero bytes at the start and the end.
+// It is found in the same pass over the track which swaps the CHD byte order of the samples, one sector at a time with SIMD where available.
+struct SilenceMap
+{
+	enum { SECTOR_BYTES = 2352 };
+	struct Run { size_t first, count; };
+	std::vector<Run> runs;
+	size_t in_zeros, out_zeros;
+	size_t scanned, audio_end; // number of bytes scanned so far and end of the last non-silent byte (0 if all silent so far)
+
+	typedef bool (*SwapFn)(Bit8u* p, size_t len); // swaps the bytes of 16-bit samples and returns true if they were all zero
+
+	void SwapAndScan(Bit8u* data, size_t len)
+	{
+		runs.clear();
+		scanned = audio_end = 0;
+		SwapAndScanNext(data, len);
+	}
+
+	// Continues with the next part of a track which is read in parts, all but the last part need to be a multiple of SECTOR_BYTES long
+	void SwapAndScanNext(Bit8u* data, size_t len)
+	{
+		static const SwapFn swap = SelectSwap();
+		size_t base = scanned / SECTOR_BYTES, sectors = (len + SECTOR_BYTES - 1) / SECTOR_BYTES, first = sectors, last = 0;
+		for (size_t sector = 0; sector != sectors; sector++)
+		{
+			size_t ofs = sector * SECTOR_BYTES;
+			if (!swap(data + ofs, (len - ofs < SECTOR_BYTES ? len - ofs : SECTOR_BYTES))) { if (first == sectors) first = sector; last = sector; }
+			else if (!runs.empty() && runs.back().first + runs.back().count == base + sector) runs.back().count++;
+			else { Run r = { base + sector, 1 }; runs.push_back(r); }
+		}
+		if (first != sectors)
+		{
+			size_t begin = first * SECTOR_BYTES, end = ((last + 1) * SECTOR_BYTES < len ? (last + 1) * SECTOR_BYTES : len);
+			if (!audio_end) { while (!data[begin]) begin++; in_zeros = scanned + begin; }
+			while (!data[end - 1]) end--;
+			audio_end = scanned + end;
+		}
+		scanned += len;
+		if (!audio_end) in_zeros = scanned; // all silent
+		out_zeros = (audio_end ? scanned - audio_end : 0);
+	}
+
+	static void Swap(Bit8u* data, size_t len)
+	{
+		static const SwapFn swap = SelectSwap();
+		swap(data, len);
+	}
+
+	bool IsSilent(size_t sector) const
+	{
+		size_t lo = 0, hi = runs.size();
+		while (lo != hi) { size_t mid = (lo + hi) / 2; if (runs[mid].first + runs[mid].count <= sector) lo = mid + 1; else hi = mid; }
+		return (lo != runs.size() && runs[lo].first <= sector);
+	}
+
+	static SwapFn SelectSwap()
+	{
+		#ifdef CHDTOOGG_X86
+		Bit32u regs[4], maxLeaf, leaf1ecx, leaf1edx;
+		CPUID(0, 0, regs);
+		if ((maxLeaf = regs[0]) < 1) return SwapPortable;
+		CPUID(1, 0, regs); leaf1ecx = regs[2]; leaf1edx = regs[3];
+		if (maxLeaf >= 7 && (leaf1ecx & (1 << 27)) && (XGETBV0() & 6) == 6) { CPUID(7, 0, regs); if (regs[1] & (1 << 5)) return SwapAVX2; } // AVX2 and the OS saves YMM registers
+		if (leaf1edx & (1 << 26)) return SwapSSE2;
+		#endif
+		return SwapPortable; // 64-bit words which compilers also vectorize for other architectures
+	}
+
+	static bool SwapPortable(Bit8u* p, size_t len)
+	{
+		Bit64u any = 0, x;
+		for (; len >= 8; p += 8, len -= 8)
+		{
+			memcpy(&x, p, 8);
+			any |= x;
+			x = ((x & 0x00FF00FF00FF00FFLL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFLL);
+			memcpy(p, &x, 8);
+		}
+		for (Bit8u tmp; len >= 2; p += 2, len -= 2) { any |= p[0] | p[1]; tmp = p[0]; p[0] = p[1]; p[1] = tmp; }
+		return !any;
+	}
+
+	#ifdef CHDTOOGG_X86
+	CHDTOOGG_TARGET("sse2") static bool SwapSSE2(Bit8u* p, size_t len)
+	{
+		__m128i any = _mm_setzero_si128();
+		for (; len >= 16; p += 16, len -= 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)p);
+			any = _mm_or_si128(any, x);
+			_mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+		}
+		bool tailSilent = SwapPortable(p, len);
+		return tailSilent && _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xFFFF;
+	}
+
+	CHDTOOGG_TARGET("avx2") static bool SwapAVX2(Bit8u* p, size_t len)
+	{
+		__m256i any = _mm256_setzero_si256();
+		for (; len >= 32; p += 32, len -= 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)p);
+			any = _mm256_or_si256(any, x);
+			_mm256_storeu_si256((__m256i*)p, _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8)));
+		}
+		bool tailSilent = SwapPortable(p, len);
+		return tailSilent && _mm256_testz_si256(any, any);
+	}
+	#endif
+};
+
+// Split the PCM data of a long audio track into segments of about segSectors sectors which are encoded as separate links of a chained Ogg file.
+// The boundaries are on a fixed grid but get moved to the closest point between two fully silent sectors within an eighth of the segment length.
+// The PCM data starts at sector firstSector of the silence map.
+static void SplitSegments(const SilenceMap& silence, size_t firstSector, size_t len, size_t segSectors, std::vector<size_t>& bounds)
+{
+	enum { SECTOR_BYTES = SilenceMap::SECTOR_BYTES };
+	size_t sectors = len / SECTOR_BYTES, window = segSectors / 8;
+	bounds.assign(1, 0);
+	for (size_t target = segSectors; target + segSectors / 2 < sectors; target += segSectors)
+	{
+		size_t split = target;
+		for (size_t d = 0; d <= window; d++)
+		{
+			if (target - d > bounds.back() / SECTOR_BYTES + 1 && silence.IsSilent(firstSector + target - d - 1) && silence.IsSilent(firstSector + target - d)) { split = target - d; break; }
+			if (target + d + 1 < sectors && silence.IsSilent(firstSector + target + d - 1) && silence.IsSilent(firstSector + target + d)) { split = target + d; break; }
+		}
+		bounds.push_back(split * SECTOR_BYTES);
+	}
+	bounds.push_back(len);
+}
+
+// A track read from the CHD file which gets written out and hashed once the output data for all quality levels is ready
+enum ConvertResult { CONVERT_OK, CONVERT_FAILED, CONVERT_INVALID };
+
+// One CHD file being converted, in batch mode its last tracks can still be encoding while the next CHD file is already being read
+struct DiscJob
+{
+	std::string pathCHD;
+	std::vector<OutputSet> sets;
+	size_t pathDirLen;
+	bool showXML, hashing, update, batch, encodeFailed; // hashing is set if the outputs get hashed for the XML, the manifest or the journal
+	bool skipped; // all its CUE files were completed according to the journal
+	ConvertResult result; // of reading the CHD file until it is completed
+	SourceHashCache hashCache;
+	Journal* journal; // set with --journal
+	FILE* fXML; // where the XML elements get printed
+
+	ConvertResult Complete();
+	void Discard();
+};
+
+// Track data buffers are kept for later tracks instead of returning them to the system after each track, which saves
+// mapping and faulting in the memory of large tracks again and again when many CHD files are converted in batch mode
+struct TrackBuffers
+{
+	enum { MAX_SPARE = 2 };
+	struct Spare { Bit8u* p; size_t cap; };
+
+	static Bit8u* Alloc(size_t size, size_t& cap)
+	{
+		std::vector<Spare>& spare = List();
+		size_t best = spare.size();
+		for (size_t i = 0; i != spare.size(); i++)
+			if (spare[i].cap >= size && (best == spare.size() || spare[i].cap < spare[best].cap)) best = i;
+		if (best == spare.size()) { cap = size; return (Bit8u*)malloc(size); }
+		Bit8u* p = spare[best].p;
+		cap = spare[best].cap;
+		spare.erase(spare.begin() + best);
+		return p;
+	}
+
+	static void Free(Bit8u* p, size_t cap)
+	{
+		if (!p) return;
+		std::vector<Spare>& spare = List();
+		Spare s = { p, cap };
+		spare.push_back(s);
+		if (spare.size() <= MAX_SPARE) return;
+		size_t smallest = 0;
+		for (size_t i = 1; i != spare.size(); i++) if (spare[i].cap < spare[smallest].cap) smallest = i;
+		free(spare[smallest].p);
+		spare.erase(spare.begin() + smallest);
+	}
+
+	static Bit64u SpareBytes()
+	{
+		std::vector<Spare>& spare = List();
+		Bit64u total = 0;
+		for (size_t i = 0; i != spare.size(); i++) total += spare[i].cap;
+		return total;
+	}
+
+	static void Release()
+	{
+		std::vector<Spare>& spare = List();
+		for (size_t i = 0; i != spare.size(); i++) free(spare[i].p);
+		spare.clear();
+	}
+
+	static std::vector<Spare>& List() { static std::vector<Spare> spare; return spare; }
+};
+
+// Memory budget for track data set with --mem-limit. A track is only read into memory once its estimated peak use fits,
+// the fixed memory of the encoder instances is subtracted from the limit up front.
+struct MemBudget
+{
+	enum { ENCODER_BYTES = 4*1024*1024 }; // linear memory of one encoder instance (at most 21 pages of 64 KB) plus the ring buffers of a worker
+	Bit64u limit, used;
+
+	bool Fits(Bit64u need) const { return used + need + TrackBuffers::SpareBytes() <= limit; }
+
+	// The PCM or data of the track plus the buffered Ogg output of segments after the first, estimated at 1.5 times the nominal bitrate
+	static Bit64u Estimate(size_t track_size, bool isAudio, const std::vector<OutputSet>& sets, int segmentSecs)
+	{
+		static const int kbps[11] = { 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 500 };
+		Bit64u need = track_size;
+		if (isAudio && segmentSecs > 0)
+			for (size_t iset = 0; iset != sets.size(); iset++)
+				need += (Bit64u)track_size / 176400 * kbps[sets[iset].quality] * 1000 / 8 * 3 / 2;
+		return need;
+	}
+};
+
+struct TrackJob
+{
+	struct Segment
+	{
+		Encode enc;
+		bool failed, done;
+		#ifdef CHDTOOGG_WORKERS
+		std::thread thread;
+		#endif
+	};
+	struct Output
+	{
+		std::vector<Segment> segments; // a single segment unless a long audio track is split into a chained Ogg file
+		std::string pathTrack, pathTemp, cachePath; // the track is written to pathTemp, cachePath is set if the encoded track gets added to the encode cache
+		FILE* fOut;
+		HashCtx romHash;
+		// Set if the track file is unchanged since the last run or was linked from the encode cache, it then has no segments
+		bool kept;
+		unsigned keptSegments;
+		Bit64u keptSize;
+		HashResult keptRes;
+		EncodeCheckpoint ckpt; // path is set with --checkpoint for audio tracks
+		std::string settings; // listed in the manifest, see OutputManifest::Settings
+	};
+	std::vector<Output> outputs; // one per output set
+	Bit8u* track_data;
+	size_t track_size, pregap_size, data_size, track_cap;
+	int mt_track_no, mt_frames, mt_pregap, segment_secs;
+	Bit32u in_zeros, out_zeros;
+	SilenceMap silence; // audio tracks only
+	bool isAudio, srcCached; // srcRes, in_zeros and out_zeros were loaded from the hash cache
+	HashResult srcRes; // CRC32 of audio tracks is the trimmed one
+	SourceHashCache* hashCache;
+	MemBudget* mem; // memUsed gets returned to it when the job is deleted
+	Bit64u memUsed;
+	struct DiscJob* disc;
+	struct PendingList* pending; // set while the track is being encoded on workers
+	#ifdef CHDTOOGG_WORKERS
+	HashPool* hashPool; // set when the hashes are calculated in the background
+	HashPool::Buffer srcHash;
+
+	void StartHashing(HashPool* pool)
+	{
+		hashPool = pool;
+		if (srcCached) return;
+		SourceHashJob(srcHash.job);
+		pool->Add(&srcHash);
+	}
+
+	// Wait for background hashing to stop reading from the track data
+	void StopHashing()
+	{
+		if (hashPool && !srcCached) hashPool->Wait(&srcHash);
+	}
+	#endif
+
+	void SourceHashJob(HashJob& job) const
+	{
+		job.data = track_data;
+		job.size = track_size;
+		job.crcBegin = (isAudio ? in_zeros : 0); // the CRC of the silence around audio gets added afterwards
+		job.crcEnd = (isAudio ? track_size - out_zeros : track_size);
+	}
+
+	// Add the CRC32 of the silence around an audio track to the trimmed CRC32
+	Bit32u UntrimmedCRC32(Bit32u trimmedcrc32) const
+	{
+		return CRC32Zeros(CRC32Combine(CRC32Zeros(0, in_zeros), trimmedcrc32, track_size - in_zeros - out_zeros), out_zeros);
+	}
+
+	void Finish()
+	{
+		std::vector<OutputSet>& sets = disc->sets;
+		const size_t pathDirLen = disc->pathDirLen;
+		const bool showXML = disc->showXML;
+		std::vector<char> written(outputs.size(), 0);
+		size_t numWritten = 0;
+		for (size_t iout = 0; iout != outputs.size(); iout++)
+		{
+			Output& out = outputs[iout];
+			if (out.kept) { if (!out.ckpt.path.empty()) remove(out.ckpt.path.c_str()); written[iout] = 1; numWritten++; continue; }
+			Encode& enc = out.segments[0].enc;
+			bool failed = false;
+			for (size_t iseg = 0; iseg != out.segments.size(); iseg++) failed |= out.segments[iseg].failed;
+			if (failed)
+			{
+				fprintf(stderr, "  Error: Encoder worker crashed while compressing track %d\n", mt_track_no);
+				fclose(out.fOut);
+				remove(out.pathTemp.c_str());
+				for (size_t iseg = 0; iseg != out.segments.size(); iseg++) if (out.segments[iseg].enc.romcap) free(out.segments[iseg].enc.rombuf);
+				continue;
+			}
+			for (size_t iseg = 1; iseg != out.segments.size(); iseg++)
+			{
+				Encode::AppendChained(&enc, out.segments[iseg].enc.rombuf, out.segments[iseg].enc.romlen, (Bit32u)iseg);
+				free(out.segments[iseg].enc.rombuf);
+			}
+			if (!enc.fOut) fwrite(enc.rombuf, enc.romlen, 1, out.fOut);
+			fclose(out.fOut);
+			if (!ReplaceFile(out.pathTemp, out.pathTrack))
+			{
+				if (out.segments[0].enc.romcap) free(out.segments[0].enc.rombuf);
+				disc->encodeFailed = true;
+				continue;
+			}
+			if (!out.ckpt.path.empty()) remove(out.ckpt.path.c_str());
+			if (!out.cachePath.empty()) EncodeCache::Store(out.pathTrack, out.cachePath);
+			written[iout] = 1;
+			numWritten++;
+		}
+
+		if (disc->hashing && numWritten)
+		{
+			fprintf(stderr, "  Calculating checksum...\n");
+			if (!srcCached && track_data) // not read if all outputs are reused and the source hashes aren't needed
+			{
+				#ifdef CHDTOOGG_WORKERS
+				if (hashPool) { hashPool->Wait(&srcHash); srcRes = srcHash.job.res; } // hashed in the background since the track was read
+				else
+				#endif
+				{ HashJob job; SourceHashJob(job); HashMulti(&job, 1); srcRes = job.res; }
+			}
+			if (!srcCached && track_data && hashCache) hashCache->Add(mt_track_no, track_size, in_zeros, out_zeros, srcRes);
+			const Bit8u *srcmd5 = srcRes.md5, *srcsha1 = srcRes.sha1;
+			Bit32u srccrc32 = srcRes.crc32, trimmedcrc32 = 0;
+			if (isAudio)
+			{
+				trimmedcrc32 = srccrc32;
+				srccrc32 = UntrimmedCRC32(trimmedcrc32);
+			}
+
+			for (size_t iout = 0; iout != outputs.size(); iout++)
+			{
+				if (!written[iout]) continue;
+				Output& out = outputs[iout];
+				HashResult romres = srcRes;
+				size_t romlen;
+				unsigned numSegments;
+				if (out.kept)
+				{
+					romres = out.keptRes;
+					romlen = (size_t)out.keptSize;
+					numSegments = out.keptSegments;
+				}
+				else
+				{
+					// Encoded outputs were hashed while they were written, a data track output is either the source or the tiny empty track
+					Encode& enc = out.segments[0].enc;
+					if (enc.hash || enc.rombuf != track_data)
+					{
+						if (!enc.hash) { out.romHash.Init(); out.romHash.Update(enc.rombuf, enc.romlen); }
+						out.romHash.Final(romres);
+					}
+					romlen = enc.romlen;
+					numSegments = (unsigned)out.segments.size();
+				}
+				OutputManifest::Entry mentry;
+				if ((disc->update || disc->journal) && OutputManifest::MakeEntry(mt_track_no, out.settings, out.pathTrack, numSegments, romres, mentry))
+				{
+					if (disc->update) sets[iout].manifest.entries.push_back(mentry);
+					if (disc->journal) disc->journal->Track(sets[iout].pathCUE, mentry);
+				}
+				if (!showXML) continue;
+				Bit32u romcrc32 = romres.crc32;
+				const Bit8u *rommd5 = romres.md5, *romsha1 = romres.sha1;
+
+				std::string& pathTrack = out.pathTrack;
+				std::vector<char>& xmlTrack = sets[iout].xmlTracks[mt_track_no-1];
+				for (size_t posAmp = pathDirLen - 1; (posAmp = pathTrack.find('&', posAmp + 1)) != std::string::npos;) pathTrack.insert(posAmp + 1, "amp;"); // encode & to &amp;
+				xmlTrack.resize(600 + (pathTrack.size() - pathDirLen));
+				char* pxml = &xmlTrack[0];
+				pxml += sprintf(pxml, "\t\t<rom name=\"%s\" size=\"%u\" crc=\"%08x\" md5=\"", (pathTrack.c_str() + pathDirLen), (unsigned)romlen, romcrc32);
+				for (size_t posAmp = pathDirLen - 1; (posAmp = pathTrack.find('&', posAmp + 1)) != std::string::npos;) pathTrack.replace(posAmp + 1, 4, ""); // revert &amp; to &
+				for (int rommd5i = 0; rommd5i != 16; rommd5i++) pxml += sprintf(pxml, "%02x", rommd5[rommd5i]);
+				pxml += sprintf(pxml, "\" sha1=\"");
+				for (int romsha1i = 0; romsha1i != 20; romsha1i++) pxml += sprintf(pxml, "%02x", romsha1[romsha1i]);
+				pxml += sprintf(pxml, "\">\n");
+
+				pxml += sprintf(pxml, "\t\t\t<source frames=\"%d\" pregap=\"%d\" duration=\"%02d:%02d:%02d\" size=\"%u\" crc=\"%08x\" md5=\"", mt_frames, mt_pregap, ((mt_frames/75/60)%100), (mt_frames/75)%60, mt_frames%75, (Bit32u)track_size, srccrc32);
+				for (int srcmd5i = 0; srcmd5i != 16; srcmd5i++) pxml += sprintf(pxml, "%02x", srcmd5[srcmd5i]);
+				pxml += sprintf(pxml, "\" sha1=\"");
+				for (int srcsha1i = 0; srcsha1i != 20; srcsha1i++) pxml += sprintf(pxml, "%02x", srcsha1[srcsha1i]);
+				if (isAudio) pxml += sprintf(pxml, "\" in_zeros=\"%u\" out_zeros=\"%u\" trimmed_crc=\"%08x\" quality=\"%d", in_zeros, out_zeros, trimmedcrc32, sets[iout].quality);
+				if (isAudio && numSegments > 1) pxml += sprintf(pxml, "\" format=\"chained\" segment_length=\"%d\" segments=\"%u", segment_secs, numSegments);
+				if (isAudio && pregap_size > in_zeros) pxml += sprintf(pxml, "\" non_silence_pregap=\"1");
+				pxml += sprintf(pxml, "\"/>\n\t\t</rom>\n");
+			}
+		}
+		#ifdef CHDTOOGG_WORKERS
+		StopHashing();
+		#endif
+		for (size_t iout = 0; iout != outputs.size(); iout++)
+			if (written[iout] && !outputs[iout].kept && outputs[iout].segments[0].enc.romcap) free(outputs[iout].segments[0].enc.rombuf);
+		TrackBuffers::Free(track_data, track_cap);
+		fprintf(stderr, "  Finished processing track %d!\n", mt_track_no);
+	}
+
+	~TrackJob() { if (mem) mem->used -= memUsed; }
+
+	#ifdef CHDTOOGG_WORKERS
+	static void RunEncode(TrackJob* trk, Segment* seg, EncodePool* pool, int quality);
+	static bool FinishNext(struct PendingList& pending, size_t maxRunning);
+	#endif
+};
+
+// Converts a track which doesn't fit into the memory limit by reading it from the CHD file in small parts. The first pass scans audio for silence,
+// calculates the source hashes and writes data track outputs, then each segment of the audio outputs is encoded in another pass over its part.
+struct TrackStream
+{
+	enum { CHUNK_SECTORS = 448, CD_FRAME_SIZE = 2448 }; // about 1 MB per read
+	FILE* fCHD;
+	const Bit32u* hunkmap;
+	size_t hunkbytes, frame; // frame of the track start in the CHD
+	TrackJob* trk;
+	std::vector<Bit8u> buf;
+	size_t bufPos, sector, endSector, skip; // while encoding, skip is set when continuing from a checkpoint
+	Encode* enc;
+
+	bool Read(size_t first, size_t count)
+	{
+		const size_t data_size = trk->data_size;
+		buf.resize(count * data_size);
+		bufPos = 0;
+		for (size_t i = 0; i != count; i++)
+		{
+			size_t p = (frame + first + i) * CD_FRAME_SIZE, hunk_pos = hunkmap[p / hunkbytes];
+			if (!hunk_pos) { memset(&buf[i * data_size], 0, data_size); continue; }
+			fseek_wrap(fCHD, hunk_pos + (p % hunkbytes), SEEK_SET);
+			if (!fread(&buf[i * data_size], data_size, 1, fCHD)) return false;
+		}
+		return true;
+	}
+
+	bool Scan(bool hashSource, bool writeData)
+	{
+		HashCtx hash;
+		hash.Init(0, (trk->isAudio ? 0 : (Bit64u)-1)); // the CRC of audio is continued below up to the end of the audio found so far
+		Bit32u crc = 0;
+		SilenceMap& silence = trk->silence;
+		for (size_t first = 0, sectors = (size_t)trk->mt_frames, count; first != sectors; first += count)
+		{
+			count = (sectors - first < CHUNK_SECTORS ? sectors - first : CHUNK_SECTORS);
+			if (!Read(first, count)) return false;
+			Bit8u* p = &buf[0];
+			size_t len = buf.size(), pos = first * trk->data_size;
+			if (trk->isAudio)
+			{
+				size_t prevEnd = (first ? silence.audio_end : 0);
+				if (!first) silence.SwapAndScan(p, len);
+				else silence.SwapAndScanNext(p, len);
+				if (hashSource && silence.audio_end != prevEnd)
+				{
+					size_t from = (prevEnd ? prevEnd : silence.in_zeros);
+					if (from < pos) { crc = CRC32Zeros(crc, pos - from); from = pos; } // the gap since the end of the previous audio is silence
+					crc = CRC32(p + (from - pos), silence.audio_end - from, crc);
+				}
+			}
+			if (hashSource) hash.Update(p, len);
+			if (writeData)
+				for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+					if (!trk->outputs[iout].kept) fwrite(p, len, 1, trk->outputs[iout].fOut);
+		}
+		if (hashSource) { hash.Final(trk->srcRes); if (trk->isAudio) trk->srcRes.crc32 = crc; }
+		return true;
+	}
+
+	bool EncodeSegment(int quality, TrackJob::Segment& seg, size_t firstByte)
+	{
+		enc = &seg.enc;
+		sector = firstByte / trk->data_size;
+		endSector = sector + seg.enc.wavpcmlen / trk->data_size;
+		buf.clear();
+		bufPos = skip = 0;
+		if (!enc->ckpt || !enc->ckpt->Resume(quality, (fnEncodeVorbisFeedSamples)FeedSamples, (fnEncodeVorbisOutput)OggOutput, this, skip))
+			WasmEncodeVorbis(quality, (fnEncodeVorbisFeedSamples)FeedSamples, (fnEncodeVorbisOutput)OggOutput, this);
+		return (sector == endSector && bufPos == buf.size());
+	}
+
+	static uint32_t FeedSamples(float* bufL, float* bufR, uint32_t num, TrackStream* self)
+	{
+		// Always fill the whole request unless the end is reached to feed the encoder exactly like an encode from memory
+		uint32_t fed = 0;
+		while (fed != num)
+		{
+			if (self->bufPos == self->buf.size())
+			{
+				size_t skipSectors = self->skip / self->trk->data_size, skipBytes = self->skip % self->trk->data_size;
+				self->sector += skipSectors;
+				self->skip = 0;
+				if (self->sector == self->endSector) break;
+				size_t count = (self->endSector - self->sector < CHUNK_SECTORS ? self->endSector - self->sector : CHUNK_SECTORS);
+				if (!self->Read(self->sector, count)) { self->buf.clear(); self->endSector = (size_t)-1; break; }
+				SilenceMap::Swap(&self->buf[0], self->buf.size());
+				self->sector += count;
+				self->bufPos = skipBytes;
+			}
+			uint32_t n = (uint32_t)((self->buf.size() - self->bufPos) / 4);
+			if (n > num - fed) n = num - fed;
+			Encode::ConvertSamples(bufL + fed, bufR + fed, n, &self->buf[self->bufPos]);
+			self->bufPos += n * 4;
+			fed += n;
+		}
+		if (self->enc->ckpt) self->enc->ckpt->Fed(fed * 4);
+		return fed;
+	}
+
+	static void OggOutput(const void* data, uint32_t len, TrackStream* self) { Encode::OggOutput(data, len, self->enc); }
+};
+
+#ifdef CHDTOOGG_WORKERS
+// Tracks currently being encoded on worker threads
+struct PendingList
+{
+	std::vector<TrackJob*> tracks;
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	bool Has(const struct DiscJob* disc) const
+	{
+		for (size_t i = 0; i != tracks.size(); i++) if (tracks[i]->disc == disc) return true;
+		return false;
+	}
+
+	// Wait for all running encodes of a disc without writing their output (used on errors)
+	void Abort(const struct DiscJob* disc)
+	{
+		for (size_t i = 0; i != tracks.size(); i++)
+		{
+			if (tracks[i]->disc != disc) continue;
+			for (size_t iout = 0; iout != tracks[i]->outputs.size(); iout++)
+			{
+				TrackJob::Output& out = tracks[i]->outputs[iout];
+				for (size_t iseg = 0; iseg != out.segments.size(); iseg++)
+				{
+					TrackJob::Segment& seg = out.segments[iseg];
+					if (seg.thread.joinable()) seg.thread.join();
+				}
+			}
+			tracks[i]->StopHashing();
+			for (size_t iout = 0; iout != tracks[i]->outputs.size(); iout++)
+			{
+				TrackJob::Output& out = tracks[i]->outputs[iout];
+				for (size_t iseg = 0; iseg != out.segments.size(); iseg++)
+					if (out.segments[iseg].enc.romcap) free(out.segments[iseg].enc.rombuf);
+				if (out.fOut) { fclose(out.fOut); remove(out.pathTemp.c_str()); }
+			}
+			TrackBuffers::Free(tracks[i]->track_data, tracks[i]->track_cap);
+			delete tracks[i];
+			tracks.erase(tracks.begin() + i--);
+		}
+	}
+};
+
+void TrackJob::RunEncode(TrackJob* trk, Segment* seg, EncodePool* pool, int quality)
+{
+	bool ok = pool->Run(quality, seg->enc.wavpcm, seg->enc.wavpcmlen, (fnEncodeVorbisOutput)Encode::OggOutput, &seg->enc);
+	std::lock_guard<std::mutex> lock(trk->pending->mtx);
+	seg->failed = !ok;
+	seg->done = true;
+	trk->pending->cv.notify_all();
+}
+
+bool TrackJob::FinishNext(PendingList& pending, size_t maxRunning)
+{
+	// Finish whichever track has all its encodes completed first or return once less than maxRunning encodes are running
+	TrackJob* trk = NULL;
+	{
+		std::unique_lock<std::mutex> lock(pending.mtx);
+		for (;;)
+		{
+			size_t running = 0;
+			for (size_t i = 0; i != pending.tracks.size() && !trk; i++)
+			{
+				bool done = true;
+				for (size_t iout = 0; iout != pending.tracks[i]->outputs.size(); iout++)
+				{
+					const Output& out = pending.tracks[i]->outputs[iout];
+					for (size_t iseg = 0; iseg != out.segments.size(); iseg++)
+					{
+						done &= out.segments[iseg].done;
+						running += (out.segments[iseg].thread.joinable() && !out.segments[iseg].done);
+					}
+				}
+				if (done) { trk = pending.tracks[i]; pending.tracks.erase(pending.tracks.begin() + i); }
+			}
+			if (trk) break;
+			if (running < maxRunning) return false;
+			pending.cv.wait(lock);
+		}
+	}
+	for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+	{
+		for (size_t iseg = 0; iseg != trk->outputs[iout].segments.size(); iseg++)
+		{
+			trk->outputs[iout].segments[iseg].thread.join();
+			if (trk->outputs[iout].segments[iseg].failed) trk->disc->encodeFailed = true;
+		}
+	}
+	trk->Finish();
+	delete trk;
+	return true;
+}
+#endif
+
+// Print the XML and write the CUE files of a disc once all its tracks are finished
+ConvertResult DiscJob::Complete()
+{
+	if (skipped) return CONVERT_OK;
+	if (hashing) hashCache.Save();
+	// The manifests also list the tracks which were written when others failed so they don't need to be converted again
+	if (update) for (size_t iset = 0; iset != sets.size(); iset++) sets[iset].manifest.Save();
+	if (encodeFailed)
+	{
+		for (size_t iset = 0; iset != sets.size(); iset++)
+		{
+			fprintf(stderr, "\nError: Not all tracks could be compressed, CUE file %s was not written\n", sets[iset].pathCUE.c_str());
+			fclose(sets[iset].fCUE);
+			remove(sets[iset].pathTemp.c_str());
+		}
+		fprintf(stderr, "\n");
+		return CONVERT_FAILED;
+	}
+
+	for (size_t iset = 0; iset != sets.size(); iset++)
+	{
+		OutputSet& set = sets[iset];
+		if (showXML)
+		{
+			const char* dest = (fXML == stdout ? "standard output" : "the lease directory");
+			if (sets.size() > 1) fprintf(stderr, "\nPrinting XML elements for quality %d to %s ...\n---------------------------------------------------------------------------\n", set.quality, dest);
+			else fprintf(stderr, "\nPrinting XML elements to %s ...\n---------------------------------------------------------------------------\n", dest);
+			if (batch)
+			{
+				// In batch mode the elements of each disc are wrapped in a game element so they form one DAT together
+				std::string name(set.pathBase, pathDirLen);
+				for (size_t posAmp = 0; (posAmp = name.find('&', posAmp)) != std::string::npos; posAmp++) name.insert(posAmp + 1, "amp;");
+				fprintf(fXML, "\t<game name=\"%s\">\n", name.c_str());
+			}
+			for (size_t itrk = 0; itrk != set.cueTracks.size(); itrk++)
+				if (set.xmlTracks[itrk].size()) fputs(&set.xmlTracks[itrk][0], fXML);
+			if (batch) fputs("\t</game>\n", fXML);
+			fflush(fXML);
+			fprintf(stderr, "---------------------------------------------------------------------------\nDone!\n");
+		}
+
+		fprintf(stderr, "\nFinished processing all tracks, writing CUE file %s ...\n", set.pathCUE.c_str());
+		for (size_t itrk = 0; itrk != set.cueTracks.size(); itrk++)
+		{
+			if (set.cueTracks[itrk].size()) continue;
+			fprintf(stderr, "Error: CHD misses track %u (but has track %u)\n\n", (unsigned)(itrk + 1), (unsigned)(itrk + 2));
+			fprintf(stderr, "Error: Invalid/unsupported CHD file '%s'\n\n", pathCHD.c_str());
+			for (size_t i = 0; i != sets.size(); i++)
+				if (sets[i].fCUE) { fclose(sets[i].fCUE); remove(sets[i].pathTemp.c_str()); sets[i].fCUE = NULL; }
+			return CONVERT_INVALID;
+		}
+		for (size_t itrk = 0; itrk != set.cueTracks.size(); itrk++)
+		{
+			fwrite(&set.cueTracks[itrk][0], strlen(&set.cueTracks[itrk][0]), 1, set.fCUE);
+		}
+		fclose(set.fCUE);
+		set.fCUE = NULL;
+		if (!ReplaceFile(set.pathTemp, set.pathCUE))
+		{
+			for (size_t i = iset + 1; i != sets.size(); i++) { fclose(sets[i].fCUE); remove(sets[i].pathTemp.c_str()); sets[i].fCUE = NULL; }
+			return CONVERT_FAILED;
+		}
+		if (journal) journal->Done(set.pathCUE);
+		fprintf(stderr, "Done!\n");
+	}
+	return CONVERT_OK;
+}
+
+// Removes the temporary CUE files of a disc which doesn't get completed
+void DiscJob::Discard()
+{
+	for (size_t iset = 0; iset != sets.size(); iset++)
+		if (sets[iset].fCUE) { fclose(sets[iset].fCUE); remove(sets[iset].pathTemp.c_str()); sets[iset].fCUE = NULL; }
+}
+
+// Collect the CHD files for batch mode, either all .chd files in a directory (sorted by name) or the lines of a list file
+static bool ListBatch(const char* path, std::vector<std::string>& chds)
+{
+	struct stat st;
+	if (stat(path, &st)) return false;
+	if (st.st_mode & S_IFDIR)
+	{
+		std::string dir(path);
+		if (dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') dir += '/';
+		#ifdef _WIN32
+		struct _finddata_t fd;
+		intptr_t find = _findfirst((dir + "*.chd").c_str(), &fd);
+		if (find != -1) { do chds.push_back(dir + fd.name); while (!_findnext(find, &fd)); _findclose(find); }
+		#else
+		DIR* d = opendir(path);
+		if (!d) return false;
+		for (struct dirent* e; (e = readdir(d)) != NULL;)
+		{
+			size_t len = strlen(e->d_name);
+			if (len > 4 && e->d_name[len - 4] == '.' && (e->d_name[len - 3] | 0x20) == 'c' && (e->d_name[len - 2] | 0x20) == 'h' && (e->d_name[len - 1] | 0x20) == 'd') chds.push_back(dir + e->d_name);
+		}
+		closedir(d);
+		#endif
+		std::sort(chds.begin(), chds.end());
+		return true;
+	}
+	FILE* f = fopen(path, "r");
+	if (!f) return false;
+	for (char line[4096]; fgets(line, sizeof(line), f);)
+	{
+		size_t len = strlen(line);
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+		if (len && line[0] != '#') chds.push_back(line);
+	}
+	fclose(f);
+	return true;
+}
+
+// The name of a CHD file in batch mode without directory and extension, it replaces the * in the CUE path template
+static std::string BatchName(const std::string& pathCHD)
+{
+	const char *chdLastFS = strrchr(pathCHD.c_str(), '/'), *chdLastBS = strrchr(pathCHD.c_str(), '\\'), *chdLastS = (chdLastFS > chdLastBS ? chdLastFS : chdLastBS);
+	std::string name(chdLastS ? chdLastS + 1 : pathCHD.c_str());
+	if (name.size() > 4 && name[name.size() - 4] == '.') name.resize(name.size() - 4);
+	return name;
+}
+
+// Settings which are the same for all CHD files converted by one run of the program
+struct ConvertOptions
+{
+	const char *qualityStr, *noData, *showXML;
+	int segmentSecs;
+	int checkpointSecs; // with --checkpoint the state of audio encodes is saved every this many seconds of audio
+	bool update; // only convert tracks whose outputs changed since the manifest was written
+	Journal* journal; // set with --journal
+	const char* cacheDir; // directory of the encode cache if set
+	std::string tempSuffix; // of the files being written, with --lease it names the process so one which lost its lease never writes the same file
+	MemBudget* mem; // set with --mem-limit
+	DatVerify* verify; // if set the source tracks are only compared with the DAT
+	#ifdef CHDTOOGG_WORKERS
+	EncodePool* pool;
+	HashPool* hashPool;
+	PendingList* pending;
+	#endif
+};
+
+// Read one CHD file and start converting its tracks, CONVERT_INVALID means the input or output path is unusable.
+// When encoding on workers the last tracks can still be running on return, the disc gets completed once they are finished.
+static ConvertResult ConvertCHD(DiscJob& disc, const char* inPathCHD, const char* outPathCUE, const ConvertOptions& opt)
+{
+	const char *qualityStr = opt.qualityStr, *noData = opt.noData, *showXML = opt.showXML;
+	const int segmentSecs = opt.segmentSecs;
+	std::vector<OutputSet>& sets = disc.sets;
+	SourceHashCache& hashCache = disc.hashCache;
+	#ifdef CHDTOOGG_WORKERS
+	EncodePool& pool = *opt.pool;
+	HashPool& hashPool = *opt.hashPool;
+	PendingList& pendingTracks = *opt.pending;
+	#endif
+	disc.pathCHD = inPathCHD;
+	disc.showXML = !!showXML;
+	disc.update = opt.update;
+	disc.hashing = (showXML || opt.update || opt.journal);
+	disc.journal = opt.journal;
+	disc.encodeFailed = false;
+	disc.skipped = false;
+	disc.pathDirLen = 0;
+
+	// Multiple quality levels separated by commas output a separate set of CUE/OGG files for each level from a single read of the CHD
+	if (!opt.verify) for (const char* q = (qualityStr ? qualityStr : "8");; q++)
+	{
+		int qualityRaw = atoi(q), quality = (qualityRaw < 0 ? 0 : qualityRaw > 10 ? 10 : qualityRaw);
+		bool isDuplicate = false;
+		for (size_t iset = 0; iset != sets.size(); iset++) isDuplicate |= (sets[iset].quality == quality);
+		if (!isDuplicate) { sets.push_back(OutputSet()); sets.back().quality = quality; sets.back().fCUE = NULL; }
+		if (!(q = strchr(q, ','))) break;
+	}
+	for (size_t iset = 0; iset != sets.size(); iset++)
+	{
+		OutputSet& set = sets[iset];
+		set.pathBase.assign(outPathCUE, strlen(outPathCUE) - 4);
+		if (sets.size() > 1) { char qualityName[32]; sprintf(qualityName, " (Quality %d)", set.quality); set.pathBase += qualityName; }
+		set.pathCUE = set.pathBase + (outPathCUE + strlen(outPathCUE) - 4);
+		set.pathTemp = set.pathCUE + opt.tempSuffix;
+	}
+
+	enum { CHD_V5_HEADER_SIZE = 124, CHD_V5_UNCOMPMAPENTRYBYTES = 4, CD_MAX_SECTOR_DATA = 2352, CD_MAX_SUBCODE_DATA = 96, CD_FRAME_SIZE = CD_MAX_SECTOR_DATA + CD_MAX_SUBCODE_DATA };
+	enum { METADATA_HEADER_SIZE = 16, CDROM_TRACK_METADATA_TAG = 1128813650, CDROM_TRACK_METADATA2_TAG = 1128813618, CD_TRACK_PADDING = 4 };
+
+	// Read CHD header and check signature
+	Bit32u* chd_hunkmap = NULL;
+	Bit8u rawheader[CHD_V5_HEADER_SIZE];
+	const char* chd_errstr = NULL;
+	FILE* fCHD = fopen(inPathCHD, "rb");
+	if (!fCHD || !fread(rawheader, CHD_V5_HEADER_SIZE, 1, fCHD) || memcmp(rawheader, "MComprHD", 8))
+	{
+		chderr:
+		fprintf(stderr, (chd_errstr ? chd_errstr : "Error: Invalid/unsupported CHD file '%s'\n\n"), inPathCHD);
+		if (chd_hunkmap) free(chd_hunkmap);
+		#ifdef CHDTOOGG_WORKERS
+		pendingTracks.Abort(&disc);
+		#endif
+		for (size_t iset = 0; iset != sets.size(); iset++)
+			if (sets[iset].fCUE) { fclose(sets[iset].fCUE); remove(sets[iset].pathTemp.c_str()); }
+		if (fCHD) fclose(fCHD);
+		return CONVERT_INVALID;
+	}
+
+	// Check supported version, flags and compression
+	Bit32u hdr_length = CHD_READ_BE32(&rawheader[8]);
+	Bit32u hdr_version = CHD_READ_BE32(&rawheader[12]);
+	if (hdr_version != 5 || hdr_length != CHD_V5_HEADER_SIZE) goto chderr; // only ver 5 is supported
+	if (CHD_READ_BE32(&rawheader[16])) { chd_errstr = "Error: Compressed CHD file '%s' is not supported. CHD file needs to be made with `chdman createcd -c none`."; goto chderr; }
+
+	// Make sure it's a CD image
+	Bit32u unitsize = CHD_READ_BE32(&rawheader[60]);
+	int chd_hunkbytes = (int)CHD_READ_BE32(&rawheader[56]);
+	if (unitsize != CD_FRAME_SIZE || (chd_hunkbytes % CD_FRAME_SIZE) || !chd_hunkbytes) goto chderr; // not CD sector size
+
+	// Read file offsets for hunk mapping and track meta data
+	fseek_wrap(fCHD, 0, SEEK_END);
+	Bit64u chd_size = (Bit64u)ftell_wrap(fCHD);
+	Bit64u logicalbytes = CHD_READ_BE64(&rawheader[32]);
+	Bit64u mapoffset = CHD_READ_BE64(&rawheader[40]);
+	Bit64u metaoffset = CHD_READ_BE64(&rawheader[48]);
+	if (mapoffset < CHD_V5_HEADER_SIZE || mapoffset >= chd_size || metaoffset < CHD_V5_HEADER_SIZE || metaoffset >= chd_size || !logicalbytes) goto chderr;
+
+	// Read hunk mapping and convert to file offsets
+	Bit32u hunkcount = (Bit32u)((logicalbytes + chd_hunkbytes - 1) / chd_hunkbytes);
+	if (chd_size < mapoffset + hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES) goto chderr;
+	chd_hunkmap = (Bit32u*)malloc(hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES);
+	fseek_wrap(fCHD, mapoffset, SEEK_SET);
+	if (!fread(chd_hunkmap, hunkcount * CHD_V5_UNCOMPMAPENTRYBYTES, 1, fCHD)) goto chderr;
+	for (Bit32u j = 0; j != hunkcount; j++)
+	{
+		chd_hunkmap[j] = CHD_READ_BE32(&chd_hunkmap[j]) * chd_hunkbytes;
+		if (chd_size < chd_hunkmap[j] + chd_hunkbytes) goto chderr;
+	}
+
+	if (disc.hashing) hashCache.Load(inPathCHD, &rawheader[84], chd_size);
+	char chdKey[64];
+	SourceHashCache::MakeKey(chdKey, &rawheader[84], chd_size);
+	if (opt.update || opt.journal)
+	{
+		size_t numCompleted = 0;
+		for (size_t iset = 0; iset != sets.size(); iset++)
+		{
+			sets[iset].manifest.Load(sets[iset].pathCUE, chdKey, opt.update);
+			if (opt.journal && opt.journal->Completed(sets[iset].manifest, sets[iset].pathCUE)) numCompleted++;
+		}
+
+		// A disc whose CUE files were all completed is skipped, unless -x needs the XML elements of its tracks
+		if (numCompleted && numCompleted == sets.size() && !showXML)
+		{
+			fprintf(stderr, "Skipping %s which was completed according to the journal\n", inPathCHD);
+			disc.skipped = true;
+			free(chd_hunkmap);
+			fclose(fCHD);
+			return CONVERT_OK;
+		}
+		if (opt.journal) for (size_t iset = 0; iset != sets.size(); iset++) opt.journal->Resume(sets[iset].manifest, sets[iset].pathCUE);
+	}
+
+	// All files are written under a temporary name and renamed once they are complete, so an interrupted conversion never leaves partial files
+	for (size_t iset = 0; iset != sets.size(); iset++)
+	{
+		if ((sets[iset].fCUE = fopen(sets[iset].pathTemp.c_str(), "wb")) != NULL) continue;
+		fprintf(stderr, "Error: Unable to write output CUE file '%s'\n\n", sets[iset].pathCUE.c_str());
+		while (iset--) { fclose(sets[iset].fCUE); remove(sets[iset].pathTemp.c_str()); sets[iset].fCUE = NULL; }
+		free(chd_hunkmap);
+		fclose(fCHD);
+		return CONVERT_INVALID;
+	}
+
+	const char *cueLastFS = strrchr(outPathCUE, '/'), *cueLastBS = strrchr(outPathCUE, '\\'), *cueLastS = (cueLastFS > cueLastBS ? cueLastFS : cueLastBS);
+	const size_t pathDirLen = disc.pathDirLen = (size_t)((cueLastS ? (cueLastS + 1) : outPathCUE) - outPathCUE);
+
+	// Read track meta data
+	struct TrackMeta
+	{
+		int track_no, frames, pregap;
+		Bit32u frame; // of the track start in the CHD
+		char type[32], subtype[32];
+		// The encodes of long audio tracks get started first so they don't end up running alone at the end, data tracks are written while they run
+		static bool EncodeFirst(const TrackMeta& a, const TrackMeta& b)
+		{
+			bool aAudio = !strcmp(a.type, "AUDIO"), bAudio = !strcmp(b.type, "AUDIO");
+			return (aAudio != bAudio ? aAudio : aAudio && a.frames > b.frames);
+		}
+	};
+	std::vector<TrackMeta> metas;
+	for (Bit64u metaentry_offset = metaoffset, metaentry_next, next_frame = 0; metaentry_offset != 0; metaentry_offset = metaentry_next)
+	{
+		TrackMeta m;
+		if (chd_size < metaentry_offset + METADATA_HEADER_SIZE) goto chderr;
+		Bit8u raw_meta_header[METADATA_HEADER_SIZE];
+		fseek_wrap(fCHD, metaentry_offset, SEEK_SET);
+		if (!fread(raw_meta_header, METADATA_HEADER_SIZE, 1, fCHD)) goto chderr;
+		Bit32u metaentry_metatag = CHD_READ_BE32(&raw_meta_header[0]);
+		Bit32u metaentry_length = (CHD_READ_BE32(&raw_meta_header[4]) & 0x00ffffff);
+		metaentry_next = CHD_READ_BE64(&raw_meta_header[8]);
+		if (metaentry_metatag != CDROM_TRACK_METADATA_TAG && metaentry_metatag != CDROM_TRACK_METADATA2_TAG) continue;
+		if (chd_size < (size_t)(metaentry_offset + METADATA_HEADER_SIZE) + metaentry_length) goto chderr;
+
+		m.track_no = m.frames = m.pregap = 0;
+		if (fscanf(fCHD,
+			(metaentry_metatag == CDROM_TRACK_METADATA2_TAG ? "TRACK:%d TYPE:%30s SUBTYPE:%30s FRAMES:%d PREGAP:%d" : "TRACK:%d TYPE:%30s SUBTYPE:%30s FRAMES:%d"),
+			&m.track_no, m.type, m.subtype, &m.frames, &m.pregap) < 4) continue;
+		if (m.pregap > m.frames) { chd_errstr = "Error: Track pregap is larger than total track frame count\n"; goto chderr; }
+
+		// In CHD files tracks are padded to a to a 4-sector boundary.
+		next_frame += ((CD_TRACK_PADDING - (next_frame % CD_TRACK_PADDING)) % CD_TRACK_PADDING);
+		m.frame = (Bit32u)next_frame;
+		next_frame += (Bit32u)m.frames;
+		metas.push_back(m);
+	}
+	#ifdef CHDTOOGG_WORKERS
+	if (!pool.workers.empty()) std::stable_sort(metas.begin(), metas.end(), TrackMeta::EncodeFirst);
+	#endif
+
+	for (size_t imeta = 0; imeta != metas.size(); imeta++)
+	{
+		const char *mt_type = metas[imeta].type;
+		const int mt_track_no = metas[imeta].track_no, mt_frames = metas[imeta].frames, mt_pregap = metas[imeta].pregap;
+		Bit32u track_frame = metas[imeta].frame;
+
+		const bool isAudio = !strcmp(mt_type, "AUDIO");
+		std::string trackName(" (Track ");
+		if (mt_track_no > 99) trackName += (char)('0' + (mt_track_no/100)%10);
+		if (mt_track_no > 9) trackName += (char)('0' + (mt_track_no/10)%10);
+		trackName += (char)('0' + (mt_track_no%10));
+		trackName.append(isAudio ? ").ogg" : ").bin");
+
+		TrackJob* trk = new TrackJob();
+		trk->disc = &disc;
+		trk->outputs.resize(sets.size());
+		size_t numReused = 0;
+		for (size_t iset = 0; iset != sets.size(); iset++)
+		{
+			TrackJob::Output& out = trk->outputs[iset];
+			out.pathTrack = sets[iset].pathBase + trackName;
+			out.settings = OutputManifest::Settings(isAudio, sets[iset].quality, segmentSecs, !!noData);
+			const OutputManifest::Entry* unchanged = (opt.update || opt.journal ? sets[iset].manifest.Unchanged(mt_track_no, out.settings, out.pathTrack) : NULL);
+			if (unchanged)
+			{
+				fprintf(stderr, "Keeping unchanged track %d %s\n", mt_track_no, out.pathTrack.c_str());
+				out.kept = true;
+				out.keptSegments = unchanged->segments;
+				out.keptSize = unchanged->size;
+				out.keptRes = unchanged->res;
+				numReused++;
+				continue;
+			}
+			out.pathTemp = out.pathTrack + opt.tempSuffix;
+			if (isAudio && opt.checkpointSecs > 0)
+			{
+				char key[256];
+				sprintf(key, "CHDtoOGG checkpoint v%s %s quality=%d segment=%d track=%d", CHDTOOGG_VERSION, chdKey, sets[iset].quality, (segmentSecs > 0 ? segmentSecs : 0), mt_track_no);
+				out.ckpt.path = out.pathTemp + ".ckpt";
+				out.ckpt.key = key;
+				out.ckpt.every = out.ckpt.next = (Bit64u)opt.checkpointSecs * 44100 * 4;
+				out.fOut = out.ckpt.Open(out.pathTemp);
+			}
+			else out.fOut = fopen(out.pathTemp.c_str(), "wb");
+			fprintf(stderr, "%s track %d %s ...\n", (isAudio ? "Compressing" : "Writing"), mt_track_no, out.pathTrack.c_str());
+			if (out.fOut) continue;
+			while (iset--) if (trk->outputs[iset].fOut) { fclose(trk->outputs[iset].fOut); remove(trk->outputs[iset].pathTemp.c_str()); }
+			delete trk;
+			chd_errstr = "Error: Unable to write track file\n";
+			goto chderr;
+		}
+
+		// Read track data and calculate hashes (CHD sectorSize is always 2448, data_size is based on chdman source, except MODE2_FORM2 is treated same as MODE2_FORM1 because sector size 2324 is unsupported in BIN/CUE)
+		const bool ds2048 = !strcmp(mt_type, "MODE1") || !strcmp(mt_type, "MODE2_FORM1") || !strcmp(mt_type, "MODE2_FORM2");
+		const bool ds2336 = !strcmp(mt_type, "MODE2") || !strcmp(mt_type, "MODE2_FORM_MIX");
+		const size_t data_size = (ds2048 ? 2048 : ds2336 ? 2336 : CD_MAX_SECTOR_DATA);
+		const size_t track_size = (size_t)mt_frames * data_size, pregap_size = (size_t)mt_pregap * data_size;
+		const SourceHashCache::Entry* cached = (disc.hashing ? hashCache.Find(mt_track_no, track_size) : NULL);
+
+		// The track doesn't need to be read if all its outputs are unchanged, unless its source hashes are needed for the XML or --verify
+		const bool skipRead = (!opt.verify && numReused == sets.size() && (!showXML || cached));
+
+		// With --mem-limit the track is only read once its estimated peak memory use fits the budget, which can mean waiting for running encodes.
+		// A track which doesn't fit even when nothing else is running gets streamed from the CHD file instead.
+		bool streaming = false;
+		if (opt.mem && !skipRead)
+		{
+			Bit64u need = MemBudget::Estimate(track_size, isAudio, sets, segmentSecs);
+			if (!opt.mem->Fits(need)) TrackBuffers::Release();
+			#ifdef CHDTOOGG_WORKERS
+			while (!opt.mem->Fits(need) && !pendingTracks.tracks.empty()) TrackJob::FinishNext(pendingTracks, 0);
+			#endif
+			if (opt.mem->Fits(need)) { opt.mem->used += need; trk->mem = opt.mem; trk->memUsed = need; }
+			else streaming = true;
+		}
+		size_t trk_cap = 0;
+		Bit8u* track_data = (skipRead || streaming ? NULL : TrackBuffers::Alloc(track_size, trk_cap)), *track_out = track_data;
+		if (!skipRead && !streaming) for (Bit32u track_frame_end = track_frame + mt_frames; track_frame != track_frame_end; track_frame++, track_out += data_size)
+		{
+			size_t p = track_frame * CD_FRAME_SIZE, hunk = (p / chd_hunkbytes), hunk_ofs = (p % chd_hunkbytes), hunk_pos = chd_hunkmap[hunk];
+			if (!hunk_pos)
+			{
+				memset(track_out, 0, data_size);
+				continue;
+			}
+			fseek_wrap(fCHD, hunk_pos + hunk_ofs, SEEK_SET);
+			if (fread(track_out, data_size, 1, fCHD)) continue;
+			for (size_t iout = 0; iout != trk->outputs.size(); iout++) if (trk->outputs[iout].fOut) { fclose(trk->outputs[iout].fOut); remove(trk->outputs[iout].pathTemp.c_str()); }
+			TrackBuffers::Free(track_data, trk_cap);
+			delete trk;
+			chd_errstr = "Error: Failed to read from source file '%s'\n";
+			goto chderr;
+		}
+
+		for (size_t iset = 0; iset != sets.size(); iset++)
+			if (sets[iset].cueTracks.size() < (size_t)mt_track_no) { sets[iset].cueTracks.resize((size_t)mt_track_no); sets[iset].xmlTracks.resize((size_t)mt_track_no); }
+
+		trk->track_data = track_data;
+		trk->track_cap = trk_cap;
+		trk->track_size = track_size;
+		trk->pregap_size = pregap_size;
+		trk->data_size = data_size;
+		trk->mt_track_no = mt_track_no;
+		trk->mt_frames = mt_frames;
+		trk->mt_pregap = mt_pregap;
+		trk->isAudio = isAudio;
+		trk->hashCache = (disc.hashing ? &hashCache : NULL);
+		if (cached) { trk->srcCached = true; trk->srcRes = cached->res; trk->in_zeros = cached->in_zeros; trk->out_zeros = cached->out_zeros; }
+
+		//Function to load data into out with 56448 bytes allocated (stored compressed in 2919 bytes)
+		extern void GetEmptyDataTrackBin(Bit8u*);
+		static Bit8u emptyDataTrackBin[24 * CD_MAX_SECTOR_DATA];
+
+		TrackStream stream = { fCHD, chd_hunkmap, (size_t)chd_hunkbytes, (size_t)metas[imeta].frame, trk };
+		const bool hashSource = (streaming && (opt.verify || (disc.hashing && !trk->srcCached)));
+		if (streaming)
+		{
+			// Data track outputs get written while the source hashes are calculated, the empty data track doesn't need any reading
+			fprintf(stderr, "  Track %d does not fit into the memory limit, streaming it from the CHD file\n", mt_track_no);
+			if ((isAudio || hashSource || !noData) && !stream.Scan(hashSource, !isAudio && !noData)) goto streamerr;
+		}
+
+		if (isAudio && (track_data || streaming))
+		{
+			// CHD audio endian swap and silence at the start and end of the track in one pass
+			if (track_data) trk->silence.SwapAndScan(track_data, track_size);
+			Bit32u& in_zeros = trk->in_zeros, &out_zeros = trk->out_zeros;
+			if (!trk->srcCached) { in_zeros = (Bit32u)trk->silence.in_zeros; out_zeros = (Bit32u)trk->silence.out_zeros; }
+			if (pregap_size > in_zeros) { fprintf(stderr, "  Warning: Pregap for track %d contains audio data which will get omitted in exported OGG\n", mt_track_no); fflush(stderr); }
+		}
+
+		if (opt.verify)
+		{
+			// Only the source hashes get compared with the DAT, nothing is encoded or written
+			HashResult res = trk->srcRes;
+			if (!streaming) { HashJob job; trk->SourceHashJob(job); HashMulti(&job, 1); res = job.res; }
+			Bit32u trimmedcrc32 = res.crc32;
+			if (isAudio) res.crc32 = trk->UntrimmedCRC32(trimmedcrc32);
+			opt.verify->CheckSource(mt_track_no, track_size, isAudio, trk->in_zeros, trk->out_zeros, res, trimmedcrc32);
+			TrackBuffers::Free(track_data, trk_cap);
+			delete trk;
+			continue;
+		}
+
+		// The source hashes don't depend on the encoding and get calculated in the background while the track is encoded
+		#ifdef CHDTOOGG_WORKERS
+		if (disc.hashing && track_data) trk->StartHashing(&hashPool);
+		#endif
+		if (hashSource) { trk->srcCached = true; hashCache.Add(mt_track_no, track_size, trk->in_zeros, trk->out_zeros, trk->srcRes); }
+
+		trk->segment_secs = segmentSecs;
+		if (isAudio && numReused != sets.size())
+		{
+			// Segment boundaries only depend on the PCM data and the segment length so the output is the same with any number of workers
+			std::vector<size_t> bounds;
+			if (segmentSecs > 0) SplitSegments(trk->silence, (size_t)mt_pregap, track_size - pregap_size, (size_t)segmentSecs * 75, bounds);
+			else { bounds.push_back(0); bounds.push_back(track_size - pregap_size); }
+			if (bounds.size() > 2) fprintf(stderr, "  Splitting track %d into %u segments\n", mt_track_no, (unsigned)(bounds.size() - 1));
+
+			// Outputs which are already in the encode cache are linked from there instead of being encoded
+			if (opt.cacheDir && track_data)
+			{
+				char digest[41];
+				EncodeCache::PCMDigest(track_data + pregap_size, track_size - pregap_size, digest);
+				for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+				{
+					TrackJob::Output& out = trk->outputs[iout];
+					if (out.kept) continue;
+					out.cachePath = EncodeCache::Path(opt.cacheDir, digest, sets[iout].quality, (bounds.size() > 2 ? segmentSecs : 0));
+					if (!EncodeCache::Fetch(out.cachePath, out.pathTemp, out.pathTrack, out.fOut, out.keptSize, (disc.hashing ? &out.keptRes : NULL))) continue;
+					fprintf(stderr, "  Linked track %d from encode cache %s\n", mt_track_no, out.cachePath.c_str());
+					out.cachePath.clear();
+					out.kept = true;
+					out.keptSegments = (unsigned)(bounds.size() - 1);
+					numReused++;
+				}
+			}
+
+			// All quality levels are encoded from the same PCM data which was read from the CHD only once
+			#ifdef CHDTOOGG_WORKERS
+			if (!pool.workers.empty() && numReused != sets.size() && !streaming) { trk->pending = &pendingTracks; pendingTracks.tracks.push_back(trk); }
+			#endif
+			for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+			{
+				if (trk->outputs[iout].kept) continue;
+				trk->outputs[iout].segments.resize(bounds.size() - 1);
+				for (size_t iseg = 0; iseg != bounds.size() - 1; iseg++)
+				{
+					TrackJob::Segment& seg = trk->outputs[iout].segments[iseg];
+					seg.enc.wavpcm = (track_data ? track_data + pregap_size + bounds[iseg] : NULL);
+					seg.enc.wavpcmlen = bounds[iseg + 1] - bounds[iseg];
+					if (iseg == 0)
+					{
+						// The first segment is written and hashed as it is encoded, later ones get buffered until they are appended to it
+						seg.enc.fOut = trk->outputs[iout].fOut;
+						if (disc.hashing) { seg.enc.hash = &trk->outputs[iout].romHash; seg.enc.hash->Init(); }
+						if (!trk->outputs[iout].ckpt.path.empty()) { seg.enc.ckpt = &trk->outputs[iout].ckpt; seg.enc.ckpt->enc = &seg.enc; }
+					}
+					#ifdef CHDTOOGG_WORKERS
+					if (trk->pending)
+					{
+						// Worker processes don't take checkpoints, main rejects --checkpoint together with --workers
+						if (seg.enc.ckpt) { seg.enc.ckpt->Discard(seg.enc.fOut); seg.enc.ckpt = NULL; }
+						// Wait for a running encode to finish before starting more than there are workers to limit memory usage
+						while (TrackJob::FinishNext(pendingTracks, pool.workers.size())) {}
+						seg.thread = std::thread(TrackJob::RunEncode, trk, &seg, &pool, sets[iout].quality);
+						continue;
+					}
+					#endif
+					if (streaming) { if (!stream.EncodeSegment(sets[iout].quality, seg, pregap_size + bounds[iseg])) goto streamerr; continue; }
+					if (!seg.enc.ckpt || !seg.enc.ckpt->Resume(sets[iout].quality, (fnEncodeVorbisFeedSamples)Encode::FeedSamples, (fnEncodeVorbisOutput)Encode::OggOutput, &seg.enc, seg.enc.wavpcmpos))
+						WasmEncodeVorbis(sets[iout].quality, (fnEncodeVorbisFeedSamples)Encode::FeedSamples, (fnEncodeVorbisOutput)Encode::OggOutput, &seg.enc);
+				}
+			}
+		}
+		else if (!isAudio) for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+		{
+			if (trk->outputs[iout].kept) continue;
+			trk->outputs[iout].segments.resize(1);
+			Encode& enc = trk->outputs[iout].segments[0].enc;
+			if (noData)
+			{
+				if (!emptyDataTrackBin[1]) GetEmptyDataTrackBin(emptyDataTrackBin);
+				enc.rombuf = emptyDataTrackBin;
+				enc.romlen = sizeof(emptyDataTrackBin);
+			}
+			else
+			{
+				enc.rombuf = track_data;
+				enc.romlen = track_size;
+				if (streaming) enc.fOut = trk->outputs[iout].fOut; // already written
+			}
+		}
+
+		if (0)
+		{
+			streamerr:
+			for (size_t iout = 0; iout != trk->outputs.size(); iout++)
+			{
+				TrackJob::Output& out = trk->outputs[iout];
+				for (size_t iseg = 0; iseg != out.segments.size(); iseg++) if (out.segments[iseg].enc.romcap) free(out.segments[iseg].enc.rombuf);
+				if (out.fOut) { fclose(out.fOut); remove(out.pathTemp.c_str()); }
+			}
+			delete trk;
+			chd_errstr = "Error: Failed to read from source file '%s'\n";
+			goto chderr;
+		}
+
+		for (size_t iset = 0; iset != sets.size(); iset++)
+		{
+			const std::string& pathTrack = trk->outputs[iset].pathTrack;
+			std::vector<char> &cueTrack = sets[iset].cueTracks[mt_track_no-1];
+			cueTrack.resize(160 + (pathTrack.size() - pathDirLen));
+			char *pcue = &cueTrack[0], binTrackType[16];
+			sprintf(binTrackType, (isAudio ? "AUDIO" : "MODE%c/%04d"), (noData ? '1' : mt_type[4]), (noData ? 2352 : (int)data_size)); //noData is MODE1/2352
+			pcue += sprintf(pcue, "FILE \"%s\" %s\r\n", (pathTrack.c_str() + pathDirLen), (isAudio ? "MP3" : "BINARY"));
+			pcue += sprintf(pcue, "  TRACK %02d %s\r\n", mt_track_no, binTrackType);
+			if (!mt_pregap || (noData && !isAudio))
+			{
+				// Data or audio track without pregap
+				pcue += sprintf(pcue, "    INDEX 01 00:00:00\r\n");
+			}
+			else if (isAudio)
+			{
+				// We exclude the pregap data from the OGG encode and use the PREGAP tag to indicate that it has been omitted.
+				// Alternative would be to include the pregap data and use a pair of INDEX 00 and INDEX 01 tags but it is not well supported by existing emulators.
+				pcue += sprintf(pcue, "    PREGAP %02d:%02d:%02d\r\n", (mt_pregap/(60*75))%60, (mt_pregap/75)%60, mt_pregap%75);
+				pcue += sprintf(pcue, "    INDEX 01 00:00:00\r\n");
+			}
+			else
+			{
+				// Data track with pregap use a pair of INDEX 00 and INDEX 01 tags
+				pcue += sprintf(pcue, "    INDEX 00 00:00:00\r\n");
+				pcue += sprintf(pcue, "    INDEX 01 %02d:%02d:%02d\r\n", (mt_pregap/(60*75))%60, (mt_pregap/75)%60, mt_pregap%75);
+			}
+		}
+
+		if (!trk->pending) { trk->Finish(); delete trk; }
+	}
+	free(chd_hunkmap);
+	fclose(fCHD);
+	return CONVERT_OK;
+}
+
+#ifdef CHDTOOGG_WORKERS
+// Flat JSON object with string, number and boolean values as used by the job requests of the conversion server (all values are kept as text)
+struct JsonObject
+{
+	std::vector<std::pair<std::string, std::string> > values;
+
+	bool Parse(const char* p)
+	{
+		values.clear();
+		std::string key, val;
+		if (*(p = SkipSpace(p)) != '{') return false;
+		if (*(p = SkipSpace(p + 1)) == '}') return true;
+		for (;;)
+		{
+			if (!(p = ParseString(SkipSpace(p), key)) || *(p = SkipSpace(p)) != ':') return false;
+			p = SkipSpace(p + 1);
+			if (*p == '"') { if (!(p = ParseString(p, val))) return false; }
+			else { const char* end = p; while (*end && !strchr(",} \t\r\n", *end)) end++; if (end == p) return false; val.assign(p, end); p = end; }
+			values.push_back(std::make_pair(key, val));
+			p = SkipSpace(p);
+			if (*p == '}') return true;
+			if (*p++ != ',') return false;
+		}
+	}
+
+	const char* Get(const char* key) const
+	{
+		for (size_t i = 0; i != values.size(); i++) if (values[i].first == key) return values[i].second.c_str();
+		return NULL;
+	}
+
+	bool GetBool(const char* key) const { const char* v = Get(key); return (v && strcmp(v, "false") && strcmp(v, "0") && *v); }
+
+	static const char* SkipSpace(const char* p) { while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++; return p; }
+
+	static const char* ParseString(const char* p, std::string& out)
+	{
+		if (*p++ != '"') return NULL;
+		for (out.clear(); *p != '"'; p++)
+		{
+			if (!*p) return NULL;
+			if (*p != '\\') { out += *p; continue; }
+			switch (*++p)
+			{
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+				{
+					unsigned c = 0;
+					for (int i = 0; i != 4; i++)
+					{
+						char h = *++p;
+						int v = (h >= '0' && h <= '9' ? h - '0' : (h | 0x20) >= 'a' && (h | 0x20) <= 'f' ? (h | 0x20) - 'a' + 10 : -1);
+						if (v < 0) return NULL;
+						c = (c << 4) | (unsigned)v;
+					}
+					if (c < 0x80) out += (char)c; // code points outside the BMP (surrogate pairs) aren't supported
+					else if (c < 0x800) { out += (char)(0xC0 | (c >> 6)); out += (char)(0x80 | (c & 0x3F)); }
+					else { out += (char)(0xE0 | (c >> 12)); out += (char)(0x80 | ((c >> 6) & 0x3F)); out += (char)(0x80 | (c & 0x3F)); }
+					break;
+				}
+				case '\0': return NULL;
+				default: out += *p; // \" \\ \/
+			}
+		}
+		return p + 1;
+	}
+
+	static void AppendString(std::string& json, const char* str)
+	{
+		json += '"';
+		for (; *str; str++)
+		{
+			if (*str == '"' || *str == '\\') { json += '\\'; json += *str; }
+			else if ((unsigned char)*str < 0x20) { char esc[8]; sprintf(esc, "\\u%04x", (unsigned char)*str); json += esc; }
+			else json += *str;
+		}
+		json += '"';
+	}
+};
+
+// Conversion server which keeps the encoder worker processes, hash threads and buffers warm between jobs sent over a local socket.
+// A job is one line with a JSON object like {"input":"/path/game.chd","output":"/path/game.cue","quality":"4,8","nodata":false,"xml":true,"segment":0,"update":false,"cache":"/path/cache"}.
+// The messages of the conversion are streamed back while it runs, followed by a zero byte, a line {"exit":0,"xml_bytes":N} and N bytes of XML.
+// Jobs are run one after another in the order the connections get accepted, {"shutdown":true} stops the server.
+struct ConvertServer
+{
+	enum { REQUEST_SECS = 10, MAX_REQUEST_BYTES = 64 * 1024 };
+
+	static int Serve(const char* path, const ConvertOptions& defaults)
+	{
+		sockaddr_un addr;
+		int fdListen = Bind(path, addr);
+		if (fdListen < 0) return 1;
+		signal(SIGPIPE, SIG_IGN); // a client going away must not end the server
+		fprintf(stderr, "Waiting for jobs on %s ...\n", path);
+		for (bool shutdown = false; !shutdown;)
+		{
+			int fd = accept(fdListen, NULL, NULL);
+			if (fd < 0) continue;
+			std::string line;
+			if (!ReadRequest(fd, line)) { SendResult(fd, 2, NULL, "Error: No complete job request received\n"); close(fd); continue; }
+			JsonObject job;
+			if (!job.Parse(line.c_str())) { SendResult(fd, 2, NULL, "Error: Invalid JSON job request\n"); close(fd); continue; }
+			if ((shutdown = job.GetBool("shutdown")) != false) { SendResult(fd, 0, NULL, "Server stopped\n"); close(fd); break; }
+			const char *inPathCHD = job.Get("input"), *outPathCUE = job.Get("output");
+			if (!inPathCHD || !*inPathCHD || !outPathCUE || strlen(outPathCUE) < 5) { SendResult(fd, 2, NULL, "Error: Job needs \"input\" and \"output\" paths\n"); close(fd); continue; }
+
+			// Options given to the server are the defaults for keys the job leaves out
+			ConvertOptions opt = defaults;
+			if (job.Get("quality")) opt.qualityStr = job.Get("quality");
+			if (job.Get("nodata")) opt.noData = (job.GetBool("nodata") ? "-n" : NULL);
+			if (job.Get("xml")) opt.showXML = (job.GetBool("xml") ? "-x" : NULL);
+			if (job.Get("segment")) opt.segmentSecs = atoi(job.Get("segment"));
+			if (job.Get("update")) opt.update = job.GetBool("update");
+			if (job.Get("cache")) opt.cacheDir = job.Get("cache");
+			if ((opt.showXML || opt.update) && opt.hashPool->threads.empty()) opt.hashPool->Start();
+			fprintf(stderr, "Converting %s to %s ...\n", inPathCHD, outPathCUE);
+
+			// Messages go to the client while the XML is collected in a temporary file
+			FILE* fXML = tmpfile();
+			if (!fXML) { SendResult(fd, 1, NULL, "Error: Unable to create temporary file\n"); close(fd); continue; }
+			fflush(stdout);
+			int fdOut = dup(1), fdErr = dup(2);
+			dup2(fileno(fXML), 1);
+			dup2(fd, 2);
+			DiscJob disc;
+			disc.batch = false;
+			disc.fXML = stdout;
+			ConvertResult res = ConvertCHD(disc, inPathCHD, outPathCUE, opt);
+			while (!opt.pending->tracks.empty()) TrackJob::FinishNext(*opt.pending, 0);
+			if (res == CONVERT_OK) res = disc.Complete();
+			fflush(stdout);
+			dup2(fdOut, 1);
+			dup2(fdErr, 2);
+			close(fdOut);
+			close(fdErr);
+			SendResult(fd, (res == CONVERT_OK ? 0 : 1), fXML, NULL);
+			fclose(fXML);
+			close(fd);
+			fprintf(stderr, "  %s\n", (res == CONVERT_OK ? "Done" : "Failed"));
+		}
+		close(fdListen);
+		unlink(path);
+		return 0;
+	}
+
+	// Read the request line within REQUEST_SECS so a client which connects but sends nothing can't hold up the jobs behind it
+	static bool ReadRequest(int fd, std::string& line)
+	{
+		const time_t deadline = time(NULL) + REQUEST_SECS;
+		char buf[4096];
+		for (time_t now; (now = time(NULL)) < deadline;)
+		{
+			pollfd pfd = { fd, POLLIN, 0 };
+			int ready = poll(&pfd, 1, (int)(deadline - now) * 1000);
+			if (ready < 0 && errno == EINTR) continue;
+			if (ready <= 0) break;
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n <= 0) break;
+			const char* eol = (const char*)memchr(buf, '\n', (size_t)n);
+			line.append(buf, (eol ? (size_t)(eol - buf) : (size_t)n));
+			if (line.size() > MAX_REQUEST_BYTES) break;
+			if (eol) return true;
+		}
+		return false;
+	}
+
+	// Send a job to a running server, the messages are printed to stderr, the XML to stdout and the exit code is the one of the job
+	static int Submit(const char* path, const std::string& request)
+	{
+		sockaddr_un addr;
+		int fd = Connect(path, addr);
+		if (fd < 0) { fprintf(stderr, "Error: Unable to connect to conversion server at '%s'\n\n", path); return 1; }
+		std::string req(request + "\n");
+		for (size_t pos = 0; pos != req.size();)
+		{
+			ssize_t n = write(fd, req.data() + pos, req.size() - pos);
+			if (n <= 0) { close(fd); fprintf(stderr, "Error: Lost connection to conversion server\n\n"); return 1; }
+			pos += (size_t)n;
+		}
+		std::string tail;
+		bool inResult = false;
+		char buf[4096];
+		for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;)
+		{
+			const char* zero = (inResult ? NULL : (const char*)memchr(buf, 0, (size_t)n));
+			if (inResult) { tail.append(buf, (size_t)n); continue; }
+			fwrite(buf, 1, (zero ? (size_t)(zero - buf) : (size_t)n), stderr);
+			if (zero) { inResult = true; tail.append(zero + 1, (size_t)(buf + n - zero - 1)); }
+		}
+		close(fd);
+		size_t eol = tail.find('\n');
+		JsonObject result;
+		if (!inResult || eol == std::string::npos || !result.Parse(tail.substr(0, eol).c_str()) || !result.Get("exit"))
+			{ fprintf(stderr, "Error: Lost connection to conversion server\n\n"); return 1; }
+		size_t xmlBytes = (result.Get("xml_bytes") ? (size_t)strtoull(result.Get("xml_bytes"), NULL, 10) : 0);
+		if (xmlBytes) fwrite(tail.data() + eol + 1, 1, (xmlBytes < tail.size() - eol - 1 ? xmlBytes : tail.size() - eol - 1), stdout);
+		fflush(stdout);
+		return atoi(result.Get("exit"));
+	}
+
+	static void SendResult(int fd, int exitCode, FILE* fXML, const char* message)
+	{
+		std::string msg;
+		if (message) msg.append(message);
+		size_t xmlBytes = (fXML ? (size_t)ftell_wrap(fXML) : 0);
+		char result[64];
+		sprintf(result, "{\"exit\":%d,\"xml_bytes\":%llu}\n", exitCode, (unsigned long long)xmlBytes);
+		msg.append(1, '\0').append(result);
+		if (fXML)
+		{
+			std::vector<char> xml(xmlBytes);
+			rewind(fXML);
+			if (xmlBytes && fread(&xml[0], 1, xmlBytes, fXML) == xmlBytes) msg.append(&xml[0], xmlBytes);
+		}
+		for (size_t pos = 0; pos != msg.size();)
+		{
+			ssize_t n = write(fd, msg.data() + pos, msg.size() - pos);
+			if (n <= 0) break;
+			pos += (size_t)n;
+		}
+	}
+
+	static bool MakeAddr(const char* path, sockaddr_un& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) { fprintf(stderr, "Error: Socket path '%s' is too long\n\n", path); return false; }
+		strcpy(addr.sun_path, path);
+		return true;
+	}
+
+	static int Connect(const char* path, sockaddr_un& addr)
+	{
+		int fd;
+		if (!MakeAddr(path, addr) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+		if (!connect(fd, (sockaddr*)&addr, sizeof(addr))) return fd;
+		close(fd);
+		return -1;
+	}
+
+	static int Bind(const char* path, sockaddr_un& addr)
+	{
+		int fd = Connect(path, addr);
+		if (fd >= 0) { close(fd); fprintf(stderr, "Error: Another server is already running on '%s'\n\n", path); return -1; }
+		unlink(path); // left behind by a server which didn't stop properly
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) || listen(fd, 64))
+		{
+			fprintf(stderr, "Error: Unable to listen on socket '%s'\n\n", path);
+			if (fd >= 0) close(fd);
+			return -1;
+		}
+		return fd;
+	}
+};
+#endif
+
+#ifdef CHDTOOGG_WORKERS
+// Coordinator-free sharding of a batch over processes on any number of machines which share the lease directory (for example over NFS).
+// A CHD file is claimed by exclusively creating NAME.lease whose modification time is refreshed while it converts, so the lease of a
+// process which died expires and gets taken over. A finished CHD file is marked by NAME.done with its XML elements or by NAME.failed.
+struct LeaseDir
+{
+	enum { EXPIRE_SECS = 60, REFRESH_SECS = 10, POLL_SECS = 5 };
+	enum State { FREE, LEASED, FINISHED };
+	std::string dir, owner, clockPath;
+	std::vector<std::string> held; // names of the CHD files claimed by this process which are not finished yet
+	std::thread refresher;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool quit;
+
+	LeaseDir() : quit(false) { }
+
+	~LeaseDir()
+	{
+		if (!refresher.joinable()) return;
+		{ std::lock_guard<std::mutex> lock(mtx); quit = true; }
+		cv.notify_all();
+		refresher.join();
+		remove(clockPath.c_str());
+	}
+
+	bool Open(const char* path)
+	{
+		struct stat st;
+		if (stat(path, &st) || !(st.st_mode & S_IFDIR)) { fprintf(stderr, "Error: Lease directory '%s' does not exist\n\n", path); return false; }
+		char host[256] = "", buf[300];
+		gethostname(host, sizeof(host) - 1);
+		sprintf(buf, "%s.%d", host, (int)getpid());
+		owner = buf;
+		dir = path;
+		if (dir[dir.size() - 1] != '/') dir += '/';
+		clockPath = dir + "." + owner + ".clock";
+		FILE* f = fopen(clockPath.c_str(), "wb");
+		if (!f) { fprintf(stderr, "Error: Unable to write to lease directory '%s'\n\n", path); return false; }
+		fclose(f);
+		refresher = std::thread(RefreshMain, this);
+		return true;
+	}
+
+	// Lease ages are measured with the clock of the file system so machines whose clocks differ agree on them
+	time_t Now()
+	{
+		struct stat st;
+		return (!utime(clockPath.c_str(), NULL) && !stat(clockPath.c_str(), &st) ? st.st_mtime : time(NULL));
+	}
+
+	State Check(const std::string& name, time_t now)
+	{
+		struct stat st;
+		if (!stat((dir + name + ".done").c_str(), &st) || !stat((dir + name + ".failed").c_str(), &st)) return FINISHED;
+		if (stat((dir + name + ".lease").c_str(), &st)) return FREE;
+		return (now - st.st_mtime > EXPIRE_SECS ? FREE : LEASED);
+	}
+
+	// Returns FINISHED once all CHD files are finished, otherwise FREE if any of them can be claimed
+	State Scan(const std::vector<std::string>& chds)
+	{
+		time_t now = Now();
+		State res = FINISHED;
+		for (size_t i = 0; i != chds.size() && res != FREE; i++)
+		{
+			State s = Check(BatchName(chds[i]), now);
+			if (s != FINISHED) res = s;
+		}
+		return res;
+	}
+
+	bool Claim(const std::string& name)
+	{
+		std::string path(dir + name + ".lease");
+		time_t now = Now();
+		if (Check(name, now) != FREE) return false;
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0 && errno == EEXIST)
+		{
+			// The lease is linked to a name of this process and checked through that, so a lease which was refreshed in the meantime is never
+			// touched. It is only removed by a process which sees its own link as the only other one, if two try at once both leave it.
+			std::string mine(path + "." + owner);
+			struct stat st;
+			bool expired = (!link(path.c_str(), mine.c_str()) && !stat(mine.c_str(), &st) && st.st_nlink == 2 && now - st.st_mtime > EXPIRE_SECS);
+			if (expired) remove(path.c_str());
+			remove(mine.c_str());
+			if (!expired) return false;
+			fprintf(stderr, "\nTaking over expired lease of %s\n", name.c_str());
+			fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		}
+		if (fd < 0) return false;
+		std::string line(owner + "\n");
+		if (write(fd, line.data(), line.size())) {}
+		close(fd);
+
+		// Another process could have finished it between the check and creating the lease
+		if (Check(name, now) == FINISHED) { remove(path.c_str()); return false; }
+		std::lock_guard<std::mutex> lock(mtx);
+		held.push_back(name);
+		return true;
+	}
+
+	// Whether the lease still names this process, it could have expired while this process was stalled and been taken over
+	bool Holds(const std::string& name)
+	{
+		char buf[300];
+		FILE* f = fopen((dir + name + ".lease").c_str(), "rb");
+		if (!f) return false;
+		size_t n = fread(buf, 1, sizeof(buf), f);
+		fclose(f);
+		return (std::string(buf, n) == owner + "\n");
+	}
+
+	// The XML elements of a claimed CHD file are written to a temporary file which becomes the marker once it is finished
+	FILE* OpenResult(const std::string& name)
+	{
+		FILE* f = fopen((dir + name + ".done." + owner).c_str(), "wb");
+		if (!f) fprintf(stderr, "Warning: Unable to write result file for %s into lease directory\n", name.c_str());
+		return f;
+	}
+
+	void Release(const std::string& name, FILE* fResult, bool ok)
+	{
+		std::string tmp(dir + name + ".done." + owner);
+		if (fResult) fclose(fResult);
+		if (!ok || !fResult || !ReplaceFile(tmp, dir + name + ".done"))
+		{
+			remove(tmp.c_str());
+			FILE* f = fopen((dir + name + ".failed").c_str(), "wb");
+			if (f) fclose(f);
+		}
+		remove((dir + name + ".lease").c_str());
+		Forget(name);
+	}
+
+	// Stops refreshing a lease without touching its file, used when it was taken over by another process
+	void Forget(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		held.erase(std::find(held.begin(), held.end(), name));
+	}
+
+	// Merges the XML elements of all finished CHD files in list order, any process can do this because the result is always the same
+	void Merge(const std::vector<std::string>& chds, std::vector<std::string>& missing)
+	{
+		std::string tmp(dir + "results.xml." + owner), path(dir + "results.xml");
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if (!f) { fprintf(stderr, "Error: Unable to write merged XML file '%s'\n", path.c_str()); return; }
+		std::vector<Bit8u> buf(1024*1024);
+		for (size_t i = 0; i != chds.size(); i++)
+		{
+			FILE* fIn = fopen((dir + BatchName(chds[i]) + ".done").c_str(), "rb");
+			if (!fIn) { missing.push_back(chds[i]); continue; }
+			for (size_t n; (n = fread(&buf[0], 1, buf.size(), fIn)) != 0;) fwrite(&buf[0], n, 1, f);
+			fclose(fIn);
+		}
+		fclose(f);
+		if (ReplaceFile(tmp, path)) fprintf(stderr, "Merged the XML elements of all CHD files into %s\n", path.c_str());
+	}
+
+	static void RefreshMain(LeaseDir* self)
+	{
+		std::unique_lock<std::mutex> lock(self->mtx);
+		while (!self->quit)
+		{
+			for (size_t i = 0; i != self->held.size(); i++) utime((self->dir + self->held[i] + ".lease").c_str(), NULL);
+			self->cv.wait_for(lock, std::chrono::seconds(REFRESH_SECS));
+		}
+	}
+};
+#endif
+
+int main(int argc, const char** argv)
+{
+	// Parse commandline arguments
+	const char *inPathCHD = NULL, *outPathCUE = NULL, *qualityStr = NULL, *noData = NULL, *showXML = NULL, *workersStr = NULL, *segmentStr = NULL, *verifyPath = NULL, *batchPath = NULL, *servePath = NULL, *submitPath = NULL, *update = NULL, *cacheDir = NULL, *memLimitStr = NULL, *journalPath = NULL, *checkpointStr = NULL, *leasePath = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--workers")) { if (workersStr || ++i == argc) goto argerr; workersStr = argv[i]; continue; }
+		if (!strcmp(argv[i], "--segment")) { if (segmentStr || ++i == argc) goto argerr; segmentStr = argv[i]; continue; }
+		if (!strcmp(argv[i], "--verify"))  { if (verifyPath || ++i == argc) goto argerr; verifyPath = argv[i]; continue; }
+		if (!strcmp(argv[i], "--update"))  { if (update) goto argerr; update = argv[i]; continue; }
+		if (!strcmp(argv[i], "--cache"))   { if (cacheDir   || ++i == argc) goto argerr; cacheDir   = argv[i]; continue; }
+		if (!strcmp(argv[i], "--mem-limit")) { if (memLimitStr || ++i == argc) goto argerr; memLimitStr = argv[i]; continue; }
+		if (!strcmp(argv[i], "--journal")) { if (journalPath || ++i == argc) goto argerr; journalPath = argv[i]; continue; }
+		if (!strcmp(argv[i], "--checkpoint")) { if (checkpointStr || ++i == argc) goto argerr; checkpointStr = argv[i]; continue; }
+		if (!strcmp(argv[i], "--lease"))   { if (leasePath  || ++i == argc) goto argerr; leasePath  = argv[i]; continue; }
+		if (!strcmp(argv[i], "--serve"))   { if (servePath  || ++i == argc) goto argerr; servePath  = argv[i]; continue; }
+		if (!strcmp(argv[i], "--submit"))  { if (submitPath || ++i == argc) goto argerr; submitPath = argv[i]; continue; }
+		if ((argv[i][0] != '-' && argv[i][0] != '/') || !argv[i][1] || argv[i][2]) goto argerr;
+		switch (argv[i][1])
+		{
+			case 'i': if (inPathCHD  || ++i == argc) goto argerr; inPathCHD  = argv[i]; continue;
+			case 'I': if (batchPath  || ++i == argc) goto argerr; batchPath  = argv[i]; continue;
+			case 'o': if (outPathCUE || ++i == argc) goto argerr; outPathCUE = argv[i]; continue;
+			case 'q': if (qualityStr || ++i == argc) goto argerr; qualityStr = argv[i]; continue;
+			case 'n': if (noData ) goto argerr; noData  = argv[i]; continue;
+			case 'x': if (showXML) goto argerr; showXML = argv[i]; continue;
+		}
+		argerr: fprintf(stderr, "Unknown command line option '%s'.\n\n", argv[i]); goto help;
+	}
+	if (verifyPath && !outPathCUE) outPathCUE = verifyPath; // files listed in the DAT are next to it unless -o specifies a different place
+	if (servePath ? (!*servePath || inPathCHD || outPathCUE || batchPath || verifyPath || submitPath || journalPath || leasePath) :
+		submitPath ? (!*submitPath || !inPathCHD || !*inPathCHD || !outPathCUE || strlen(outPathCUE) < 5 || batchPath || verifyPath || journalPath || checkpointStr || workersStr || memLimitStr || leasePath) :
+		verifyPath ? (!*verifyPath || (inPathCHD && !*inPathCHD) || batchPath || update || cacheDir || journalPath || checkpointStr) :
+		batchPath ? (!*batchPath || inPathCHD || !outPathCUE || !strchr(outPathCUE, '*') || (leasePath && !*leasePath)) : (!inPathCHD || !*inPathCHD || !outPathCUE || !*outPathCUE || leasePath))
+	{
+		help:
+		fprintf(stderr, "%s v%s - Command line options:\n"
+			"  -i <PATH>       : Path to input CHD file (required)\n"
+			"  -o <PATH>       : Path to output CUE file (required)\n"
+			"  -I <PATH>       : Convert all CHD files listed in a text file or found in a directory instead of -i\n"
+			"                    (then -o is a template like out/*.cue where * is replaced by the CHD file name)\n"
+			"  -q <LEVEL>      : Quality level 0 to 10, defaults to 8 (a list like 4,8 outputs a set for each)\n"
+			"  -n              : Output an empty data track\n"
+			"  -x              : Print XML DAT meta data\n"
+			"  --workers <NUM> : Encode up to NUM audio tracks in parallel (auto picks NUM from the CPU topology)\n"
+			"  --segment <SEC> : Split audio tracks into a chained OGG of SEC second segments to encode them in parallel\n"
+			"  --update        : Only convert tracks whose files are missing or changed since the last run with --update\n"
+			"  --cache <DIR>   : Link audio tracks which were encoded before from the encode cache in DIR\n"
+			"  --mem-limit <MB>: Only read as many tracks into memory as fit into MB megabytes, larger tracks are read in parts\n"
+			"  --journal <PATH>: Record completed files in the journal PATH so an interrupted conversion resumes where it stopped\n"
+			"  --checkpoint <MIN>: Save the encoder state every MIN minutes of audio so an interrupted encode continues from there\n"
+			"  --lease <DIR>   : With -I, share the batch with other processes by claiming CHD files through lease files in DIR\n"
+			"  --verify <PATH> : Check existing output files against an XML DAT made with -x instead of converting\n"
+			"                    (with -i the source tracks in the CHD are checked as well)\n"
+			"  --serve <PATH>  : Run as a server which converts jobs sent to the local socket PATH\n"
+			"  --submit <PATH> : Send the conversion to the server listening on PATH instead of running it\n"
+			"\n", "CHDtoOGG", CHDTOOGG_VERSION);
+		return 1;
+	}
+	if (checkpointStr && workersStr && (!strcmp(workersStr, "auto") || atoi(workersStr) > 1))
+	{
+		fprintf(stderr, "Error: --checkpoint can't be used with --workers because worker processes don't take checkpoints\n\n");
+		return 1;
+	}
+	#ifdef CHDTOOGG_WORKERS
+	if (submitPath)
+	{
+		// The paths are made absolute because the server can run in a different directory
+		char cwdbuf[4096];
+		std::string cwd(getcwd(cwdbuf, sizeof(cwdbuf)) ? cwdbuf : ""), req("{\"input\":");
+		cwd += '/';
+		JsonObject::AppendString(req, ((inPathCHD[0] == '/' ? std::string() : cwd) + inPathCHD).c_str());
+		req += ",\"output\":";
+		JsonObject::AppendString(req, ((outPathCUE[0] == '/' ? std::string() : cwd) + outPathCUE).c_str());
+		if (qualityStr) { req += ",\"quality\":"; JsonObject::AppendString(req, qualityStr); }
+		if (segmentStr) req.append(",\"segment\":").append(segmentStr[0] >= '0' && segmentStr[0] <= '9' ? segmentStr : "0");
+		if (noData) req += ",\"nodata\":true";
+		if (showXML) req += ",\"xml\":true";
+		if (update) req += ",\"update\":true";
+		if (cacheDir) { req += ",\"cache\":"; JsonObject::AppendString(req, ((cacheDir[0] == '/' ? std::string() : cwd) + cacheDir).c_str()); }
+		req += "}";
+		return ConvertServer::Submit(submitPath, req);
+	}
+	#else
+	if (servePath || submitPath) { fprintf(stderr, "Error: The conversion server is not supported on this platform\n\n"); return 1; }
+	#endif
+
+	// Very simple test if the ogg encoding produces the expected bits
+	struct TestEncode
+	{
+		enum { TEST_LEN = 5000, TEST_EXPECT_CRC = 0x79d89c91 };
+		float buf[TEST_LEN], *bufp; Bit32u crc;
+		static uint32_t FeedSamples(float* bufL, float* bufR, uint32_t num, TestEncode* self)
+		{
+			uint32_t remain = (uint32_t)(self->buf + TEST_LEN - self->bufp);
+			if (remain < num) num = remain;
+			memcpy(bufL, self->bufp, num*4); memcpy(bufR, self->bufp, num*4);
+			self->bufp += num;
+			return num;
+		}
+		static void OggOutput(const void* data, uint32_t len, TestEncode* self) { self->crc ^= CRC32(data, len); }
+	} *testenc = (TestEncode*)malloc(sizeof(TestEncode));
+
+	for (float *bufp = testenc->buf, *bufpend = bufp + TestEncode::TEST_LEN, seed = 0; bufp != bufpend; bufp++)
+		*bufp = (seed += (seed > 1 ? -1 : 0.000188019f*(bufpend-bufp)));
+	testenc->bufp = testenc->buf;
+	testenc->crc = 0;
+	WasmEncodeVorbis(5, (fnEncodeVorbisFeedSamples)TestEncode::FeedSamples, (fnEncodeVorbisOutput)TestEncode::OggOutput, testenc);
+	Bit32u testrescrc = testenc->crc;
+	free(testenc);
+	if (testrescrc != TestEncode::TEST_EXPECT_CRC)
+	{
+		fprintf(stderr, "This system failed to produce the expected encoding results, please report this as a bug at https://github.com/PureDOS/CHDtoOGG\n\n");
+		fprintf(stderr, "Expected result: 0x%08x - Test result: 0x%08x\n\n", TestEncode::TEST_EXPECT_CRC, testrescrc);
+		return 1;
+	}
+
+	int workers = (workersStr ? atoi(workersStr) : 1), segmentSecs = (segmentStr ? atoi(segmentStr) : 0);
+	#ifdef CHDTOOGG_WORKERS
+	// With --workers auto as many workers as fit into the L3 caches with the memory the self-test needed are pinned spread over them.
+	// A fixed number is left to the scheduler because the placement is the same for every process and would stack them on the same cores.
+	CpuTopology topology;
+	const Bit64u workingSet = WasmEncodeVorbisMemoryUsed();
+	const bool pinWorkers = (workersStr && !strcmp(workersStr, "auto"));
+	if (pinWorkers)
+	{
+		topology.Load();
+		workers = (int)(topology.domains.empty() ? std::thread::hardware_concurrency() : topology.Slots(workingSet));
+		fprintf(stderr, "Using %d encoder worker processes for %u cache domains\n", workers, (unsigned)topology.domains.size());
+	}
+	#endif
+	struct stat cacheStat;
+	if (cacheDir && (stat(cacheDir, &cacheStat) || !(cacheStat.st_mode & S_IFDIR))) { fprintf(stderr, "Error: Encode cache directory '%s' does not exist\n\n", cacheDir); return 1; }
+	Journal journal;
+	if (journalPath && !journal.Open(journalPath)) return 1;
+	#ifdef CHDTOOGG_WORKERS
+	LeaseDir lease;
+	if (leasePath && !lease.Open(leasePath)) return 1;
+	#else
+	if (leasePath) { fprintf(stderr, "Error: Lease directories are not supported on this platform\n\n"); return 1; }
+	#endif
+
+	// Verification only reads files, the CHD is optional to also check the source hashes
+	DatVerify verify;
+	if (verifyPath)
+	{
+		const char *datLastFS = strrchr(outPathCUE, '/'), *datLastBS = strrchr(outPathCUE, '\\'), *datLastS = (datLastFS > datLastBS ? datLastFS : datLastBS);
+		if (!verify.Load(verifyPath, outPathCUE, (size_t)((datLastS ? (datLastS + 1) : outPathCUE) - outPathCUE))) return 1;
+		#ifdef CHDTOOGG_WORKERS
+		if (!workersStr) workers = (int)std::thread::hardware_concurrency();
+		#endif
+		verify.HashFiles(workers);
+		if (!inPathCHD) return verify.Finish(false);
+		fprintf(stderr, "\nVerifying source tracks in CHD file %s ...\n", inPathCHD);
+		showXML = NULL;
+		workers = 1;
+	}
+
+	#ifdef CHDTOOGG_WORKERS
+	// Start worker processes before opening any files or starting threads
+	EncodePool pool;
+	std::vector<int> cpus;
+	if (workers > 1 && pinWorkers) topology.Place((size_t)workers, workingSet, cpus);
+	if (workers > 1 && pool.Start(workers, cpus) != (size_t)workers) fprintf(stderr, "Warning: Only started %u of %d encoder worker processes\n", (unsigned)pool.workers.size(), workers);
+	HashPool hashPool;
+	if (showXML || update || journalPath) hashPool.Start();
+	PendingList pendingTracks;
+	#else
+	if (workers > 1) fprintf(stderr, "Warning: Parallel encoding with worker processes is not supported on this platform\n");
+	#endif
+
+	ConvertOptions opt;
+	opt.qualityStr = qualityStr;
+	opt.noData = noData;
+	opt.showXML = showXML;
+	opt.segmentSecs = segmentSecs;
+	opt.checkpointSecs = (checkpointStr ? atoi(checkpointStr) * 60 : 0);
+	opt.update = !!update;
+	opt.cacheDir = cacheDir;
+	opt.tempSuffix = ".tmp";
+	#ifdef CHDTOOGG_WORKERS
+	if (leasePath) opt.tempSuffix = "." + lease.owner + ".tmp";
+	#endif
+	opt.journal = (journalPath ? &journal : NULL);
+
+	// The fixed memory of the encoder instances (this process and the workers) is taken from the limit before any tracks
+	MemBudget mem = { 0, 0 };
+	size_t encoders = 1;
+	#ifdef CHDTOOGG_WORKERS
+	encoders += pool.workers.size();
+	#endif
+	if (memLimitStr && (Bit64u)atoi(memLimitStr) * 1024 * 1024 > encoders * MemBudget::ENCODER_BYTES) mem.limit = (Bit64u)atoi(memLimitStr) * 1024 * 1024 - encoders * MemBudget::ENCODER_BYTES;
+	opt.mem = (memLimitStr ? &mem : NULL);
+	opt.verify = (verifyPath ? &verify : NULL);
+	#ifdef CHDTOOGG_WORKERS
+	opt.pool = &pool;
+	opt.hashPool = &hashPool;
+	opt.pending = &pendingTracks;
+	if (servePath) return ConvertServer::Serve(servePath, opt);
+	#endif
+
+	if (batchPath)
+	{
+		// All CHD files get converted by this process so the self-test, the worker processes and the track buffers are shared.
+		// The next CHD file is read while the last tracks of the previous ones are still encoding, discs get completed in order.
+		std::vector<std::string> chds, failed;
+		std::vector<DiscJob*> discs;
+		size_t numClaimed = 0; // with --lease only the CHD files claimed by this process are converted
+		if (!ListBatch(batchPath, chds)) { fprintf(stderr, "Error: Unable to read batch list file or directory '%s'\n\n", batchPath); goto help; }
+		for (size_t i = 0, icomplete = 0;;)
+		{
+			#ifdef CHDTOOGG_WORKERS
+			if (i == chds.size() && !pendingTracks.tracks.empty()) TrackJob::FinishNext(pendingTracks, 0); // all read, wait for the remaining encodes
+			while (TrackJob::FinishNext(pendingTracks, (size_t)-1)) {}
+			#endif
+			for (; icomplete != discs.size(); icomplete++)
+			{
+				DiscJob* disc = discs[icomplete];
+				#ifdef CHDTOOGG_WORKERS
+				if (pendingTracks.Has(disc)) break;
+				#endif
+				#ifdef CHDTOOGG_WORKERS
+				if (leasePath && !lease.Holds(BatchName(disc->pathCHD)))
+				{
+					// The process which took over the expired lease writes the same outputs, so this one only drops its result
+					fprintf(stderr, "\nLost the lease of %s to another process, dropping its result\n", disc->pathCHD.c_str());
+					disc->Discard();
+					lease.Forget(BatchName(disc->pathCHD));
+					numClaimed--;
+					delete disc;
+					continue;
+				}
+				if (leasePath && !(disc->fXML = lease.OpenResult(BatchName(disc->pathCHD)))) disc->fXML = stdout;
+				#endif
+				if (disc->result == CONVERT_OK) disc->result = disc->Complete();
+				if (disc->result != CONVERT_OK) failed.push_back(disc->pathCHD);
+				#ifdef CHDTOOGG_WORKERS
+				if (leasePath) lease.Release(BatchName(disc->pathCHD), (disc->fXML != stdout ? disc->fXML : NULL), disc->result == CONVERT_OK);
+				#endif
+				delete disc;
+			}
+			if (i == chds.size())
+			{
+				if (icomplete != discs.size()) continue;
+				#ifdef CHDTOOGG_WORKERS
+				// Once this process is idle it waits for the CHD files claimed by others, and takes over the ones whose lease expired
+				LeaseDir::State state = (leasePath ? lease.Scan(chds) : LeaseDir::FINISHED);
+				if (state == LeaseDir::LEASED) sleep(LeaseDir::POLL_SECS);
+				if (state != LeaseDir::FINISHED) { i = 0; continue; }
+				#endif
+				break;
+			}
+
+			std::string name(BatchName(chds[i])), pathCUE(outPathCUE);
+			#ifdef CHDTOOGG_WORKERS
+			if (leasePath && !lease.Claim(name)) { i++; continue; }
+			#endif
+			numClaimed++;
+			pathCUE.replace(pathCUE.find('*'), 1, name);
+			fprintf(stderr, "\n[%u/%u] Converting %s to %s ...\n", (unsigned)(i + 1), (unsigned)chds.size(), chds[i].c_str(), pathCUE.c_str());
+			DiscJob* disc = new DiscJob();
+			disc->batch = true;
+			disc->fXML = stdout;
+			disc->result = ConvertCHD(*disc, chds[i].c_str(), pathCUE.c_str(), opt);
+			discs.push_back(disc);
+			i++;
+		}
+		fprintf(stderr, "\nConverted %u of %u CHD files%s\n", (unsigned)(numClaimed - failed.size()), (unsigned)numClaimed, (leasePath ? " claimed by this process" : ""));
+		for (size_t i = 0; i != failed.size(); i++) fprintf(stderr, "  Failed: %s\n", failed[i].c_str());
+		#ifdef CHDTOOGG_WORKERS
+		if (leasePath && showXML)
+		{
+			std::vector<std::string> missing;
+			lease.Merge(chds, missing);
+			for (size_t i = 0; i != missing.size(); i++) fprintf(stderr, "  Missing from merged XML: %s\n", missing[i].c_str());
+		}
+		#endif
+		fprintf(stderr, "\n");
+		if (journalPath) journal.Close(failed.empty());
+		return (failed.empty() ? 0 : 1);
+	}
+
+	DiscJob disc;
+	disc.batch = false;
+	disc.fXML = stdout;
+	ConvertResult res = ConvertCHD(disc, inPathCHD, outPathCUE, opt);
+	#ifdef CHDTOOGG_WORKERS
+	while (!pendingTracks.tracks.empty()) TrackJob::FinishNext(pendingTracks, 0);
+	#endif
+	if (res == CONVERT_OK) res = disc.Complete();
+	if (journalPath) journal.Close(res == CONVERT_OK);
+	if (res == CONVERT_INVALID) goto help;
+	if (verifyPath) return verify.Finish(true);
+	return (res == CONVERT_OK ? 0 : 1);
 }
 
 //Function to load data into out with 56448 bytes allocated (stored compressed in 2919 bytes)
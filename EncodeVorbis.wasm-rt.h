@@ -33,6 +33,15 @@ typedef uint32_t (*fnEncodeVorbisFeedSamples)(float* bufL, float* bufR, uint32_t
 typedef void (*fnEncodeVorbisOutput)(const void* data, uint32_t len, void* user_data);
 extern void WasmEncodeVorbis(int quality, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data);
 
+// Snapshots of a running encode: when requested from the feed callback, the state of the encoder is passed to checkpoint before it requests more samples.
+// Resuming from that state continues with the samples after the ones fed so far and outputs the same data as the encode it was taken from.
+typedef void (*fnEncodeVorbisCheckpoint)(const void* state, uint32_t len, void* user_data);
+extern void WasmEncodeVorbisCheckpoint(fnEncodeVorbisCheckpoint checkpoint, void* user_data);
+extern int WasmResumeVorbis(int quality, const void* state, uint32_t len, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data); // returns 0 if state is not from this encoder
+
+// Size of the linear memory used by the last encode in bytes
+extern uint32_t WasmEncodeVorbisMemoryUsed(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -153,18 +162,474 @@ static inline int __builtin_clzll(uint64_t value) { uint32_t msh = (uint32_t)(va
 #pragma GCC diagnostic ignored "-Wstringop-overflow" // dlmalloc out of memory forced crash
 #endif
 
-/* Use clib math as is */
+/* Math functions imported by the encoder. By default bundled implementations are used because the results of the C library
+ * functions can differ in the last bit between platforms and library versions which can change the encoded output.
+ * The bundled functions are correctly rounded (apart from subnormal results). The result is first calculated with an error
+ * bound of 2^-63 and only if that is too close to a rounding boundary it is recalculated with double-double arithmetic
+ * (around 2^-100). This only relies on IEEE 754 double arithmetic in round to nearest mode (set in WasmEncodeVorbis). */
+//#define WASM_RT_USE_CLIB_MATH
+
 #include <math.h>
 #include <fenv.h>
+#include <string.h>
+#define Z_envZ_sqrtZ_dd static_cast<f64(*)(f64)>(&sqrt)
+#define Z_envZ_fabsZ_dd static_cast<f64(*)(f64)>(&fabs)
+#ifdef WASM_RT_USE_CLIB_MATH
 #define Z_envZ_sinZ_dd static_cast<f64(*)(f64)>(&sin)
 #define Z_envZ_cosZ_dd static_cast<f64(*)(f64)>(&cos)
 #define Z_envZ_logZ_dd static_cast<f64(*)(f64)>(&log)
 #define Z_envZ_expZ_dd static_cast<f64(*)(f64)>(&exp)
 #define Z_envZ_atanZ_dd static_cast<f64(*)(f64)>(&atan)
 #define Z_envZ_powZ_ddd static_cast<f64(*)(f64,f64)>(&pow)
-#define Z_envZ_sqrtZ_dd static_cast<f64(*)(f64)>(&sqrt)
-#define Z_envZ_fabsZ_dd static_cast<f64(*)(f64)>(&fabs)
 #define Z_envZ_ldexpZ_ddi static_cast<f64(*)(f64,int)>(&ldexp)
+#else
+/* Double-double value hi + lo with |lo| <= ulp(hi)/2 */
+struct wasm_dd { f64 hi, lo; };
+static inline wasm_dd wasm_dd_make(f64 hi, f64 lo) { wasm_dd r; r.hi = hi; r.lo = lo; return r; }
+static inline wasm_dd wasm_dd_fast_two_sum(f64 a, f64 b) { wasm_dd r; r.hi = a + b; r.lo = b - (r.hi - a); return r; } /* |a| >= |b| */
+static inline wasm_dd wasm_dd_two_sum(f64 a, f64 b) { wasm_dd r; r.hi = a + b; f64 bb = r.hi - a; r.lo = (a - (r.hi - bb)) + (b - bb); return r; }
+static inline wasm_dd wasm_dd_two_prod(f64 a, f64 b)
+{
+	/* Dekker product, all partial products are exact so FMA contraction can't change the result */
+	f64 ta = 134217729.0 * a, tb = 134217729.0 * b;
+	f64 ah = ta - (ta - a), al = a - ah, bh = tb - (tb - b), bl = b - bh;
+	wasm_dd r; r.hi = a * b;
+	f64 e1 = ah * bh - r.hi, e2 = ah * bl, e3 = al * bh, e4 = al * bl;
+	r.lo = ((e1 + e2) + e3) + e4;
+	return r;
+}
+static inline wasm_dd wasm_dd_neg(wasm_dd a) { a.hi = -a.hi; a.lo = -a.lo; return a; }
+static inline wasm_dd wasm_dd_add(wasm_dd a, wasm_dd b)
+{
+	wasm_dd s = wasm_dd_two_sum(a.hi, b.hi), t = wasm_dd_two_sum(a.lo, b.lo);
+	s = wasm_dd_fast_two_sum(s.hi, s.lo + t.hi);
+	return wasm_dd_fast_two_sum(s.hi, s.lo + t.lo);
+}
+static inline wasm_dd wasm_dd_add_d(wasm_dd a, f64 b)
+{
+	wasm_dd s = wasm_dd_two_sum(a.hi, b);
+	return wasm_dd_fast_two_sum(s.hi, s.lo + a.lo);
+}
+static inline wasm_dd wasm_dd_mul(wasm_dd a, wasm_dd b)
+{
+	wasm_dd p = wasm_dd_two_prod(a.hi, b.hi);
+	f64 t1 = a.hi * b.lo, t2 = a.lo * b.hi;
+	return wasm_dd_fast_two_sum(p.hi, p.lo + (t1 + t2));
+}
+static inline wasm_dd wasm_dd_mul_d(wasm_dd a, f64 b)
+{
+	wasm_dd p = wasm_dd_two_prod(a.hi, b);
+	f64 t = a.lo * b;
+	return wasm_dd_fast_two_sum(p.hi, p.lo + t);
+}
+static inline wasm_dd wasm_dd_div(wasm_dd a, wasm_dd b)
+{
+	f64 q1 = a.hi / b.hi;
+	wasm_dd r = wasm_dd_add(a, wasm_dd_neg(wasm_dd_mul_d(b, q1)));
+	f64 q2 = r.hi / b.hi;
+	r = wasm_dd_add(r, wasm_dd_neg(wasm_dd_mul_d(b, q2)));
+	f64 q3 = r.hi / b.hi;
+	return wasm_dd_add_d(wasm_dd_fast_two_sum(q1, q2), q3);
+}
+static inline wasm_dd wasm_dd_poly(wasm_dd x, const wasm_dd* c, int n) /* c[0] + x*c[1] + ... + x^(n-1)*c[n-1] */
+{
+	wasm_dd r = c[n - 1];
+	while (--n) r = wasm_dd_add(wasm_dd_mul(r, x), c[n - 1]);
+	return r;
+}
+
+/* Tables of double-double values exp2_tbl[j] = 2^(j/64), fact_tbl[n] = 1/n!, log_tbl[j] = log((j+45)/64), atan_tbl[j] = atan(j/64), sin_tbl[j] = sin(j/64), cos_tbl[j] = cos(j/64) */
+static const wasm_dd wasm_math_exp2_tbl[64] = {
+	{ 1.0, 0.0 }, { 1.0108892860517005, -1.5234778603368577e-17 }, { 1.0218971486541166, 5.109225028973444e-17 }, { 1.0330248790212284, 7.600838874027088e-18 },
+	{ 1.0442737824274138, 8.551889705537965e-17 }, { 1.0556451783605572, 1.759325738772092e-18 }, { 1.0671404006768237, -7.899853966841582e-17 }, { 1.0787607977571199, -6.656660436056593e-17 },
+	{ 1.0905077326652577, -3.046782079812471e-17 }, { 1.102382583307841, 5.2660368715706944e-17 }, { 1.1143867425958924, 1.0410278456845571e-16 }, { 1.1265216186082418, 5.165856758795457e-17 },
+	{ 1.1387886347566916, 8.912812676025408e-17 }, { 1.1511892299529827, 3.250710218863827e-17 }, { 1.1637248587775775, 3.8292048369240935e-17 }, { 1.1763969916502812, 5.554203254218079e-17 },
+	{ 1.189207115002721, 3.982015231465646e-17 }, { 1.202156731452703, 6.644981499252301e-17 }, { 1.215247359980469, -7.712630692681488e-17 }, { 1.22848053610687, -1.89878163130253e-17 },
+	{ 1.241857812073484, 4.658027591836937e-17 }, { 1.255380757024691, -6.7113898212968784e-18 }, { 1.2690509571917332, 2.667932131342186e-18 }, { 1.2828700160787783, 1.713594918243561e-17 },
+	{ 1.2968395546510096, 2.5382502794888315e-17 }, { 1.3109612115247644, -7.181536135519454e-17 }, { 1.3252366431597413, -2.8587312100388614e-17 }, { 1.339667524053303, 8.927282594831732e-17 },
+	{ 1.3542555469368927, 7.70094837980299e-17 }, { 1.3690024229745905, 9.593797919118849e-17 }, { 1.383909881963832, -6.770511658794786e-17 }, { 1.3989796725383112, -9.614213209051323e-17 },
+	{ 1.4142135623730951, -9.667293313452913e-17 }, { 1.42961333839197, -1.2031642489053655e-17 }, { 1.4451808069770467, -3.0237581349939873e-17 }, { 1.460917794180647, -5.600377186075216e-17 },
+	{ 1.4768261459394993, -3.483994556892796e-17 }, { 1.4929077282912648, 1.4192920154284036e-17 }, { 1.5091644275934228, -1.016455327754295e-16 }, { 1.5255981507445384, -1.1024941712342561e-16 },
+	{ 1.5422108254079407, 7.949834809697621e-17 }, { 1.559004400237837, 3.7812070533575275e-17 }, { 1.5759808451078865, -1.0136916471278304e-17 }, { 1.593142151342267, -1.0094406542311964e-16 },
+	{ 1.6104903319492543, 2.4707192569797888e-17 }, { 1.6280274218573478, -6.712955084707084e-17 }, { 1.645755478153965, -1.0125679913674773e-16 }, { 1.6636765803267364, 5.8909926967131e-17 },
+	{ 1.681792830507429, 8.199010020581497e-17 }, { 1.7001063537185235, -8.0237193703977e-18 }, { 1.718619298122478, -1.851380418263111e-17 }, { 1.7373338352737062, 3.164389299292957e-17 },
+	{ 1.7562521603732995, 2.960140695448873e-17 }, { 1.7753764925265212, 6.429731796556572e-17 }, { 1.7947090750031072, 1.8227458427912087e-17 }, { 1.8142521755003989, -9.969531538920349e-17 },
+	{ 1.8340080864093424, 3.283107224245627e-17 }, { 1.8539791250833855, 9.761887490727594e-17 }, { 1.8741676341103, -6.122763413004143e-17 }, { 1.8945759815869656, 3.4034035352165297e-17 },
+	{ 1.9152065613971474, -1.0619946056195963e-16 }, { 1.9360617934922943, 1.0332385960676326e-16 }, { 1.9571441241754002, 8.960767791036668e-17 }, { 1.978456026387951, 4.0388753109278167e-17 }
+};
+static const wasm_dd wasm_math_fact_tbl[13] = {
+	{ 1.0, 0.0 }, { 1.0, 0.0 }, { 0.5, 0.0 }, { 0.16666666666666666, 9.25185853854297e-18 },
+	{ 0.041666666666666664, 2.3129646346357427e-18 }, { 0.008333333333333333, 1.1564823173178714e-19 }, { 0.001388888888888889, -5.300543954373577e-20 }, { 0.0001984126984126984, 1.7209558293420705e-22 },
+	{ 2.48015873015873e-05, 2.1511947866775882e-23 }, { 2.7557319223985893e-06, -1.858393274046472e-22 }, { 2.755731922398589e-07, 2.3767714622250297e-23 }, { 2.505210838544172e-08, -1.448814070935912e-24 },
+	{ 2.08767569878681e-09, -1.20734505911326e-25 }
+};
+static const wasm_dd wasm_math_log_tbl[47] = {
+	{ -0.3522205935893521, -5.7233316949182485e-18 }, { -0.33024168687057687, 1.0828321637483858e-17 }, { -0.3087354816496133, 1.6199186085148102e-17 }, { -0.2876820724517809, -2.607160616442564e-17 },
+	{ -0.26706278524904525, 7.32891532732017e-18 }, { -0.24686007793152578, -1.361743371748368e-17 }, { -0.22705745063534608, -9.551415762738488e-18 }, { -0.2076393647782445, -1.2053243216686129e-17 },
+	{ -0.18859116980755003, 7.432164219196925e-18 }, { -0.16989903679539747, 4.868008764439071e-19 }, { -0.15154989812720093, -5.1669593684615594e-18 }, { -0.13353139262452263, 3.664457663660085e-18 },
+	{ -0.1158318155251217, -4.338484369808096e-18 }, { -0.09844007281325252, 4.439009633675136e-18 }, { -0.0813456394539524, -5.07707635593117e-18 }, { -0.06453852113757118, 6.470486661692933e-18 },
+	{ -0.048009219186360606, -1.4390903347292205e-18 }, { -0.0317486983145803, -3.0382263084680858e-18 }, { -0.015748356968139168, -1.0021578630528974e-18 }, { 0.0, 0.0 },
+	{ 0.015504186535965254, -3.278321022892429e-19 }, { 0.030771658666753687, 1.0431732029005968e-18 }, { 0.0458095360312942, 1.902959866474257e-18 }, { 0.06062462181643484, 2.6424025938726934e-18 },
+	{ 0.07522342123758753, -5.930604196293241e-18 }, { 0.08961215868968714, -5.4268129336647135e-18 }, { 0.10379679368164356, 5.47772415726659e-18 }, { 0.11778303565638346, -1.1971685747593677e-18 },
+	{ 0.13157635778871926, 1.1123000879729588e-17 }, { 0.1451820098444979, 8.242418783022475e-18 }, { 0.15860503017663857, 1.1257003872182592e-17 }, { 0.17185025692665923, -6.0224538210113705e-18 },
+	{ 0.184922338494012, 3.0236614153574064e-18 }, { 0.19782574332991987, 1.2821194372980142e-17 }, { 0.21056476910734964, -4.249405314729895e-18 }, { 0.22314355131420976, -9.091270597324799e-18 },
+	{ 0.2355660713127669, -2.3943371495187355e-18 }, { 0.24783616390458127, -1.2432209578702523e-17 }, { 0.25995752443692605, 2.069806938978935e-17 }, { 0.27193371548364176, 7.83319637697442e-19 },
+	{ 0.2837681731306446, -2.032665581126656e-17 }, { 0.2954642128938359, -2.16461086040599e-17 }, { 0.3070250352949119, -1.2319916200101964e-17 }, { 0.3184537311185346, 2.7114779367326236e-17 },
+	{ 0.329753286372468, 2.122020616196946e-18 }, { 0.3409265869705932, 1.7467136443544747e-17 }, { 0.3519764231571782, -1.2953893030191963e-17 }
+};
+static const wasm_dd wasm_math_atan_tbl[65] = {
+	{ 0.0, 0.0 }, { 0.015623728620476831, -4.913600136566304e-19 }, { 0.031239833430268277, -1.188442711587748e-18 }, { 0.046840712915969654, -1.655677442254952e-19 },
+	{ 0.06241880999595735, -1.5490756308295046e-18 }, { 0.0779666338315423, 5.804551873143357e-18 }, { 0.09347678115858947, -6.2844725995420954e-18 }, { 0.10894195698986579, 6.8267122072409585e-18 },
+	{ 0.12435499454676144, -3.1253241424539383e-18 }, { 0.13970887428916365, -2.9579864247315813e-18 }, { 0.15499674192394097, 9.585415594114324e-18 }, { 0.1702119252854744, -3.541164079802125e-18 },
+	{ 0.18534794999569476, 4.180692268843079e-18 }, { 0.2003985538258785, 3.1399542871844493e-18 }, { 0.21535769969773805, 4.738160130078733e-19 }, { 0.23021958727684372, 1.2313404529142703e-17 },
+	{ 0.24497866312686414, 1.0698755618734451e-17 }, { 0.2596296294082575, 1.9238754924615304e-17 }, { 0.2741674511196588, 8.261353575163773e-18 }, { 0.2885873618940774, -1.428369957377257e-17 },
+	{ 0.3028848683749714, -1.1010827903001369e-17 }, { 0.31705575320914703, -1.893928924292642e-17 }, { 0.3310960767041321, -7.952610375793799e-18 }, { 0.34500217720710513, -2.2938804755578304e-17 },
+	{ 0.35877067027057225, -2.4623815582638635e-17 }, { 0.3723984466767542, 1.9612311504845653e-17 }, { 0.38588266939807375, 2.378822732491941e-17 }, { 0.39922076957525254, 2.246598105617042e-17 },
+	{ 0.4124104415973873, -1.587652227770689e-17 }, { 0.42544963737004227, 2.3315530741892885e-17 }, { 0.43833655985795783, -2.494277030626541e-17 }, { 0.4510696559885235, -2.2703795229420475e-17 },
+	{ 0.4636476090008061, 2.2698777452961687e-17 }, { 0.4760693303227612, 1.4654487332256713e-17 }, { 0.48833395105640554, -1.1373236189329585e-17 }, { 0.5004408131472942, -4.7181675085518756e-17 },
+	{ 0.5123894603107377, -2.5462781472855804e-17 }, { 0.5241796287829132, 5.520094119641666e-18 }, { 0.5358112379604637, -4.0637956834825575e-18 }, { 0.5472843809874369, 4.923709671396255e-17 },
+	{ 0.5585993153435624, -5.4556305485916264e-18 }, { 0.5697564534829784, 1.2255062085054184e-17 }, { 0.5807563535676704, -1.441464378193067e-17 }, { 0.5915997103351114, 4.920495453686772e-17 },
+	{ 0.6022873461349642, 2.950430737228402e-17 }, { 0.6128202021652414, -3.1552061848586226e-17 }, { 0.6231993299340659, 2.672403885140095e-17 }, { 0.6334258829691446, -2.7290767436015276e-17 },
+	{ 0.6435011087932844, 1.5834785051444286e-17 }, { 0.6534263411807619, 3.5800634857340095e-17 }, { 0.6632029927060933, -3.076054864429649e-17 }, { 0.6728325475937632, -1.899315009714705e-17 },
+	{ 0.6823165548747481, 6.943223671560008e-18 }, { 0.6916566218531999, -8.117151192285796e-18 }, { 0.7008544078844502, -1.987626234335816e-17 }, { 0.7099116184635249, -4.597166450584887e-17 },
+	{ 0.7188299996216245, -2.1478388444456983e-17 }, { 0.7276113326265107, 2.569325697391839e-18 }, { 0.7362574289814281, 3.473937648299457e-17 }, { 0.7447701257160751, 3.708315849135547e-17 },
+	{ 0.7531512809621944, -2.4256934659182068e-17 }, { 0.7614027698055784, 9.850030332752822e-18 }, { 0.7695264804056583, -3.704991905602721e-17 }, { 0.7775243103733478, -2.6676490951944502e-17 },
+	{ 0.7853981633974483, 3.061616997868383e-17 }
+};
+static const wasm_dd wasm_math_sin_tbl[52] = {
+	{ 0.0, 0.0 }, { 0.015624364224883372, -1.2650937552759816e-19 }, { 0.03124491398532608, -1.562781562225433e-18 }, { 0.04685783574813424, -2.3419368365610254e-18 },
+	{ 0.0624593178423802, -2.040259504585711e-18 }, { 0.07804555138996731, -5.449443782005793e-18 }, { 0.09361273123551289, 1.4628632005878733e-18 }, { 0.10915705687532236, 6.6284699502736666e-18 },
+	{ 0.12467473338522769, -2.925947496057858e-18 }, { 0.1401619723470637, -9.946847113883478e-18 }, { 0.15561499277355603, 8.886053372342288e-18 }, { 0.17103002203139503, -9.954774726452923e-18 },
+	{ 0.18640329676226988, 2.3493796901281573e-18 }, { 0.2017310638016388, 5.587232815460113e-18 }, { 0.21700958109501015, 1.1170071073364376e-17 }, { 0.23223511861151147, -8.318080852687206e-18 },
+	{ 0.24740395925452294, -7.53102495590706e-18 }, { 0.2625123997691533, -2.2534597527902125e-17 }, { 0.2775567516463363, 1.7674070262791822e-17 }, { 0.29253334202332754, 7.516944930327352e-18 },
+	{ 0.30743851458038085, 1.1004366442765296e-19 }, { 0.3222686304333866, 2.093773358126606e-17 }, { 0.33702006902225307, 1.0312279860787216e-17 }, { 0.3516892289948141, -2.5616208736069942e-17 },
+	{ 0.36627252908604757, -9.938814562106524e-18 }, { 0.38076640899239017, 2.1372528646211374e-17 }, { 0.39516733024093426, -1.9613487871414228e-17 }, { 0.40947177705329507, -5.679403000091266e-18 },
+	{ 0.42367625720393803, -2.331800700068871e-17 }, { 0.4377773028727551, 7.64345629962023e-18 }, { 0.4517714714916838, -8.234073942098903e-18 }, { 0.46565534658516017, 1.459870391051426e-17 },
+	{ 0.479425538604203, -5.103969860556013e-18 }, { 0.49307868575392305, 5.605083973871755e-18 }, { 0.5066114548142574, -3.269413423618168e-17 }, { 0.520020541953727, -3.983266745698455e-17 },
+	{ 0.5333026735360201, 5.129318115032044e-17 }, { 0.5464546069192036, 8.399754840929507e-18 }, { 0.5594731312473669, 1.575565514488728e-17 }, { 0.5723550682345072, 2.6575872357215316e-17 },
+	{ 0.5850972729404622, -5.4883972461161805e-17 }, { 0.5976966345387015, 5.450323593054385e-17 }, { 0.6101500770757914, -1.479826990758988e-17 }, { 0.6224545602223437, -6.049035765709707e-18 },
+	{ 0.6346070800152693, -3.4568582392624965e-17 }, { 0.6466046695911524, 4.567647714393289e-19 }, { 0.6584443999105676, -3.7736386700306717e-17 }, { 0.6701233804731629, 6.183536725574959e-18 },
+	{ 0.6816387600233341, 4.410467313197903e-17 }, { 0.692987727246318, -5.3543290798909455e-17 }, { 0.7041675114545337, -3.94095700584825e-17 }, { 0.7151753832640076, -1.466099578328228e-17 }
+};
+static const wasm_dd wasm_math_cos_tbl[52] = {
+	{ 1.0, 0.0 }, { 0.9998779321710066, 3.216122229972341e-17 }, { 0.9995117584851364, -3.418806487972947e-17 }, { 0.9989015683384429, -2.1425557800399754e-17 },
+	{ 0.9980475107000991, 3.3232291674141346e-17 }, { 0.9969497940760287, -1.2467075728553626e-17 }, { 0.9956086864580017, 3.312922430932991e-17 }, { 0.9940245152582091, 1.3287985046260087e-17 },
+	{ 0.992197667229329, 4.754870575189364e-17 }, { 0.9901285883701071, -4.589906353553811e-18 }, { 0.9878177838164719, 4.91917302237681e-17 }, { 0.9852658177182139, -4.925721262944555e-17 },
+	{ 0.9824733131012553, -3.919920375420088e-17 }, { 0.9794409517155483, 1.3108769521526758e-17 }, { 0.9761694738686353, -7.850690609285027e-18 }, { 0.9726596782449127, 2.3920264546490165e-17 },
+	{ 0.9689124217106447, 5.071436662403936e-17 }, { 0.964928619104771, -3.0345542681018625e-18 }, { 0.9607092430155619, -2.807827063516729e-17 }, { 0.9562553235431753, -3.148450868841629e-17 },
+	{ 0.9515679480481722, -3.8614834675674123e-17 }, { 0.9466482608860534, -3.911683334934152e-17 }, { 0.9414974631278811, -4.8523830236797095e-18 }, { 0.9361168122670553, -5.2350302039683216e-17 },
+	{ 0.9305076219123143, 4.488760003328074e-18 }, { 0.924671261467036, 5.5444125388034563e-17 }, { 0.9186091557949183, -4.0564150104514996e-17 }, { 0.9123227848721178, 2.6349040211413332e-17 },
+	{ 0.9058136834259364, 4.2864666490805214e-17 }, { 0.8990834405601384, 9.076951775075616e-18 }, { 0.8921336993669944, 2.3160655211380166e-17 }, { 0.8849661565261433, -7.690557775987357e-18 },
+	{ 0.8775825618903728, -4.2623149864279997e-17 }, { 0.8699847180584174, 1.657385110740923e-17 }, { 0.8621744799348805, 4.4132427578105805e-18 }, { 0.8541537542773854, 5.420565102675286e-18 },
+	{ 0.8459244992310679, 1.549506647350329e-17 }, { 0.8374887238505236, 4.3337026043948396e-17 }, { 0.8288484876093257, 1.1163935406617444e-17 }, { 0.820005899897234, -3.912431748209128e-17 },
+	{ 0.8109631195052179, -3.091333486122179e-17 }, { 0.8017223540984184, 4.0134533311087014e-17 }, { 0.7922858596771786, -2.9049779312834576e-17 }, { 0.7826559400262728, -1.474071641211487e-17 },
+	{ 0.7728349461524715, 4.231014921891023e-17 }, { 0.7628252757105762, 1.6672995021546628e-17 }, { 0.7526293724180665, -1.2970993013150526e-17 }, { 0.7422497254585013, -1.2339303604869521e-17 },
+	{ 0.7316888688738209, -1.0475824306512768e-17 }, { 0.7209493809456964, 3.494986701478816e-17 }, { 0.7100338835660797, 1.505272211891291e-17 }, { 0.6989450415971057, -5.5261332036460915e-18 }
+};
+static const wasm_dd wasm_math_inv_odd_tbl[9] = { /* (-1)^n / (2n+1) */
+	{ 1.0, 0.0 }, { -0.3333333333333333, -1.850371707708594e-17 }, { 0.2, -1.1102230246251566e-17 }, { -0.14285714285714285, -7.93016446160826e-18 },
+	{ 0.1111111111111111, 6.1679056923619804e-18 }, { -0.09090909090909091, 2.523234146875356e-18 }, { 0.07692307692307693, -4.270088556250602e-18 }, { -0.06666666666666667, -9.251858538542971e-19 },
+	{ 0.058823529411764705, 8.163404592832033e-19 }
+};
+static const wasm_dd wasm_math_sin_coef_tbl[9] = { /* (-1)^n / (2n+1)! */
+	{ 1.0, 0.0 }, { -0.16666666666666666, -9.25185853854297e-18 }, { 0.008333333333333333, 1.1564823173178714e-19 }, { -0.0001984126984126984, -1.7209558293420705e-22 },
+	{ 2.7557319223985893e-06, -1.858393274046472e-22 }, { -2.505210838544172e-08, 1.448814070935912e-24 }, { 1.6059043836821613e-10, 1.2585294588752098e-26 }, { -7.647163731819816e-13, -7.03872877733453e-30 },
+	{ 2.8114572543455206e-15, 1.6508842730861433e-31 }
+};
+static const wasm_dd wasm_math_cos_coef_tbl[9] = { /* (-1)^n / (2n)! */
+	{ 1.0, 0.0 }, { -0.5, 0.0 }, { 0.041666666666666664, 2.3129646346357427e-18 }, { -0.001388888888888889, 5.300543954373577e-20 },
+	{ 2.48015873015873e-05, 2.1511947866775882e-23 }, { -2.755731922398589e-07, -2.3767714622250297e-23 }, { 2.08767569878681e-09, -1.20734505911326e-25 }, { -1.1470745597729725e-11, -2.0655512752830745e-28 },
+	{ 4.779477332387385e-14, 4.399205485834081e-31 }
+};
+static const wasm_dd wasm_math_pi_2 = { 1.5707963267948966, 6.123233995736766e-17 };
+
+static inline u64 wasm_math_bits(f64 x) { u64 u; memcpy(&u, &x, 8); return u; }
+static inline f64 wasm_math_from_bits(u64 u) { f64 x; memcpy(&x, &u, 8); return x; }
+static inline f64 wasm_math_round_int(f64 x) { return (x + 6755399441055744.0) - 6755399441055744.0; } /* round to nearest integer for |x| < 2^51 */
+
+/* Returns true if all values within 2^-63 relative to a round to the same double */
+static inline bool wasm_math_round_check(wasm_dd a, f64* res)
+{
+	f64 err = (a.hi < 0 ? -a.hi : a.hi) * 1.0842021724855044e-19;
+	*res = a.hi + (a.lo + err);
+	return (*res == a.hi + (a.lo - err));
+}
+
+static inline f64 Z_envZ_ldexpZ_ddi(f64 x, int n)
+{
+	/* Same as scalbn in musl, multiplications by powers of two are exact except for the final rounding into the subnormal range */
+	if (n > 1023) { x *= 8.98846567431158e307; n -= 1023; if (n > 1023) { x *= 8.98846567431158e307; n -= 1023; if (n > 1023) n = 1023; } }
+	else if (n < -1022) { x *= 2.004168360008973e-292; n += 969; if (n < -1022) { x *= 2.004168360008973e-292; n += 969; if (n < -1022) n = -1022; } }
+	return x * wasm_math_from_bits((u64)(0x3ff + n) << 52);
+}
+
+/* exp(x) = 2^k * 2^(j/64) * exp(r) with |r| <= ln(2)/128, returns 2^(j/64) * exp(r) */
+static inline wasm_dd wasm_math_exp_dd(wasm_dd x, int* k)
+{
+	static const f64 ln2_64_1 = 0.010830424696223417, ln2_64_2 = 2.5728046223228848e-14, ln2_64_3 = 4.784126150029144e-26; /* ln(2)/64 split into 36+36+53 bits */
+	f64 n = wasm_math_round_int(x.hi * 92.33248261689366);
+	int in = (int)n, j = in & 63;
+	*k = (in - j) / 64;
+	wasm_dd r = wasm_dd_two_sum(x.hi - n * ln2_64_1, -(n * ln2_64_2)); /* both products are exact */
+	r = wasm_dd_add_d(wasm_dd_add_d(r, x.lo), -(n * ln2_64_3));
+	return wasm_dd_mul(wasm_math_exp2_tbl[j], wasm_dd_poly(r, wasm_math_fact_tbl, 13));
+}
+
+static inline f64 wasm_math_exp(f64 x)
+{
+	static const f64 ln2_64_1 = 0.010830424696223417, ln2_64_2 = 2.5728046223228848e-14, ln2_64_3 = 4.784126150029144e-26;
+	if (!(x <= 709.782712893384)) return (x != x ? x : HUGE_VAL);
+	if (x < -745.1332191019412) return 0.0;
+	if (x > -5.551115123125783e-17 && x < 5.551115123125783e-17) return 1.0 + x;
+	f64 n = wasm_math_round_int(x * 92.33248261689366), res;
+	int in = (int)n, j = in & 63, k = (in - j) / 64;
+	wasm_dd r = wasm_dd_two_sum(x - n * ln2_64_1, -(n * ln2_64_2));
+	r.lo -= n * ln2_64_3;
+	f64 q = r.hi * r.hi * (0.5 + r.hi * (0.16666666666666666 + r.hi * (0.041666666666666664 + r.hi * (0.008333333333333333 + r.hi * (0.001388888888888889 + r.hi * 0.0001984126984126984)))));
+	wasm_dd e = wasm_dd_fast_two_sum(1.0, r.hi);
+	e = wasm_dd_fast_two_sum(e.hi, e.lo + (r.lo + (r.hi * r.lo + q)));
+	if (!wasm_math_round_check(wasm_dd_mul(wasm_math_exp2_tbl[j], e), &res))
+	{
+		wasm_dd v = wasm_math_exp_dd(wasm_dd_make(x, 0.0), &k);
+		res = v.hi + v.lo;
+	}
+	return Z_envZ_ldexpZ_ddi(res, k);
+}
+
+/* log(x) = e*log(2) + log(c) + log(m/c) with m in [sqrt(1/2), sqrt(2)] and c = j/64 closest to m, log(m/c) = 2 atanh(s) with s = (m - c) / (m + c) */
+static inline wasm_dd wasm_math_log_parts(f64 x, int* e, int* j, wasm_dd* s)
+{
+	u64 u = wasm_math_bits(x);
+	*e = 0;
+	if (u < ((u64)1 << 52)) { x *= 18014398509481984.0; u = wasm_math_bits(x); *e = -54; } /* subnormal */
+	*e += (int)(u >> 52) - 1023;
+	f64 m = wasm_math_from_bits((u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	if (m > 1.4142135623730951) { m *= 0.5; (*e)++; }
+	*j = (int)wasm_math_round_int(m * 64.0);
+	f64 c = *j * 0.015625, num = m - c; /* exact */
+	wasm_dd den = wasm_dd_two_sum(m, c), p;
+	s->hi = num / den.hi;
+	p = wasm_dd_two_prod(s->hi, den.hi);
+	s->lo = (((num - p.hi) - p.lo) - s->hi * den.lo) / den.hi;
+	static const f64 ln2_1 = 0.6931471805592082, ln2_2 = 7.371002565167799e-13, ln2_3 = 1.94704509238075e-31; /* ln(2) split into 40+53+53 bits */
+	f64 fe = (f64)*e;
+	return wasm_dd_add_d(wasm_dd_add_d(wasm_dd_two_prod(fe, ln2_2), fe * ln2_3), fe * ln2_1);
+}
+
+static inline wasm_dd wasm_math_log_dd(f64 x)
+{
+	int e, j; wasm_dd s, el2 = wasm_math_log_parts(x, &e, &j, &s), inv_odd[8];
+	for (int i = 0; i != 8; i++) inv_odd[i] = (i & 1 ? wasm_dd_neg(wasm_math_inv_odd_tbl[i]) : wasm_math_inv_odd_tbl[i]);
+	wasm_dd r = wasm_dd_mul(wasm_dd_mul_d(s, 2.0), wasm_dd_poly(wasm_dd_mul(s, s), inv_odd, 8));
+	return wasm_dd_add(el2, wasm_dd_add(wasm_math_log_tbl[j - 45], r));
+}
+
+static inline f64 wasm_math_log(f64 x)
+{
+	if (x != x || x == HUGE_VAL) return x;
+	if (x == 0.0) return -HUGE_VAL;
+	if (x < 0.0) return NAN;
+	int e, j; wasm_dd s, el2 = wasm_math_log_parts(x, &e, &j, &s);
+	f64 z = s.hi * s.hi, q = 2.0 * s.hi * z * (0.3333333333333333 + z * (0.2 + z * (0.14285714285714285 + z * 0.1111111111111111))), res;
+	wasm_dd r = wasm_dd_add_d(wasm_dd_add(wasm_math_log_tbl[j - 45], wasm_dd_make(2.0 * s.hi, 2.0 * s.lo)), q);
+	if (!wasm_math_round_check(wasm_dd_add(el2, r), &res))
+	{
+		wasm_dd v = wasm_math_log_dd(x);
+		res = v.hi + v.lo;
+	}
+	return res;
+}
+
+static inline f64 Z_envZ_powZ_ddd(f64 x, f64 y)
+{
+	if (y == 0.0 || x == 1.0) return 1.0;
+	if (x != x || y != y) return x + y;
+	f64 ax = (x < 0 ? -x : x), ay = (y < 0 ? -y : y);
+	if (ay == HUGE_VAL) return (ax == 1.0 ? 1.0 : (ax < 1.0) == (y < 0.0) ? HUGE_VAL : 0.0);
+	int yint = (ay >= 9007199254740992.0 ? 2 : floor(y) != y ? 0 : (floor(y * 0.5) == y * 0.5 ? 2 : 1)); /* 0 = not an integer, 1 = odd, 2 = even */
+	f64 sign = ((wasm_math_bits(x) >> 63) && yint == 1 ? -1.0 : 1.0);
+	if (ax == 0.0) return sign * (y < 0.0 ? HUGE_VAL : 0.0);
+	if (ax == HUGE_VAL) return sign * (y < 0.0 ? 0.0 : HUGE_VAL);
+	if (x < 0.0 && !yint) return NAN;
+
+	/* pow is rarely called so this always uses the double-double path */
+	wasm_dd t = wasm_dd_mul_d(wasm_math_log_dd(ax), y);
+	if (t.hi > 709.782712893384) return sign * HUGE_VAL;
+	if (t.hi < -745.1332191019412) return sign * 0.0;
+	int k; wasm_dd r = wasm_math_exp_dd(t, &k);
+	return sign * Z_envZ_ldexpZ_ddi(r.hi + r.lo, k);
+}
+
+/* atan(a) = atan(c) + atan(w) with w = (a - c) / (1 + a*c) and c = j/64 closest to a, for |x| > 1 this uses atan(|x|) = pi/2 - atan(1/|x|) */
+static inline wasm_dd wasm_math_atan_parts(f64 ax, int* j)
+{
+	wasm_dd a = wasm_dd_make(ax, 0.0), w, p;
+	if (ax > 1.0)
+	{
+		a.hi = 1.0 / ax;
+		p = wasm_dd_two_prod(a.hi, ax);
+		a.lo = ((1.0 - p.hi) - p.lo) / ax;
+	}
+	*j = (int)wasm_math_round_int(a.hi * 64.0);
+	f64 c = *j * 0.015625;
+	wasm_dd num = wasm_dd_two_sum(a.hi - c, a.lo); /* a.hi - c is exact */
+	p = wasm_dd_two_prod(a.hi, c);
+	wasm_dd den = wasm_dd_fast_two_sum(1.0, p.hi);
+	den = wasm_dd_fast_two_sum(den.hi, den.lo + (p.lo + a.lo * c));
+	w.hi = num.hi / den.hi;
+	p = wasm_dd_two_prod(w.hi, den.hi);
+	w.lo = ((((num.hi - p.hi) - p.lo) + num.lo) - w.hi * den.lo) / den.hi;
+	return w;
+}
+
+static inline f64 wasm_math_atan(f64 x)
+{
+	if (x != x) return x;
+	f64 ax = (x < 0 ? -x : x), res;
+	if (ax < 7.450580596923828e-09) return x; /* atan(x) = x - x^3/3 rounds to x */
+	if (ax > 1.8014398509481984e16) return (x < 0 ? -wasm_math_pi_2.hi : wasm_math_pi_2.hi);
+	int j; wasm_dd w = wasm_math_atan_parts(ax, &j);
+	f64 z = w.hi * w.hi, q = -w.hi * z * (0.3333333333333333 - z * (0.2 - z * (0.14285714285714285 - z * (0.1111111111111111 - z * 0.09090909090909091))));
+	wasm_dd r = wasm_dd_add_d(wasm_dd_add(wasm_math_atan_tbl[j], w), q);
+	if (ax > 1.0) r = wasm_dd_add(wasm_math_pi_2, wasm_dd_neg(r));
+	if (!wasm_math_round_check(r, &res))
+	{
+		r = wasm_dd_add(wasm_math_atan_tbl[j], wasm_dd_mul(w, wasm_dd_poly(wasm_dd_mul(w, w), wasm_math_inv_odd_tbl, 9)));
+		if (ax > 1.0) r = wasm_dd_add(wasm_math_pi_2, wasm_dd_neg(r));
+		res = r.hi + r.lo;
+	}
+	return (x < 0 ? -res : res);
+}
+
+/* The fraction bits of 2/pi, word k holds bits 64k+1 to 64k+64 which is enough to reduce any finite double */
+static const u64 wasm_math_2_pi_tbl[21] = {
+	0xa2f9836e4e441529ULL, 0xfc2757d1f534ddc0ULL, 0xdb6295993c439041ULL, 0xfe5163abdebbc561ULL,
+	0xb7246e3a424dd2e0ULL, 0x06492eea09d1921cULL, 0xfe1deb1cb129a73eULL, 0xe88235f52ebb4484ULL,
+	0xe99c7026b45f7e41ULL, 0x3991d639835339f4ULL, 0x9c845f8bbdf9283bULL, 0x1ff897ffde05980fULL,
+	0xef2f118b5a0a6d1fULL, 0x6d367ecf27cb09b7ULL, 0x4f463f669e5fea2dULL, 0x7527bac7ebe5f17bULL,
+	0x3d0739f78a5292eaULL, 0x6bfb5fb11f8d5d08ULL, 0x56033046fc7b6babULL, 0xf0cfbc209af4361dULL,
+	0xa9e391615ee61b08ULL };
+
+/* 64 bits of 2/pi starting at fraction bit i (1-based), the first one ends up as the top bit */
+static inline u64 wasm_math_2_pi_bits(int i)
+{
+	int k = (i - 1) >> 6, o = (i - 1) & 63;
+	return (wasm_math_2_pi_tbl[k] << o) | (o ? wasm_math_2_pi_tbl[k + 1] >> (64 - o) : 0);
+}
+
+/* 64 bits of a number stored in 32 bit limbs starting at bit n, bits below 0 are zero */
+static inline u64 wasm_math_limbs_bits(const u32* p, int limbs, int n)
+{
+	u64 res = 0;
+	for (int k = 0; k != limbs; k++)
+	{
+		int sh = 32 * k - n;
+		if (sh > -32 && sh < 64) res |= (sh >= 0 ? (u64)p[k] << sh : (u64)p[k] >> -sh);
+	}
+	return res;
+}
+
+/* Payne-Hanek reduction for 2^20 <= |x| < inf. With x = m*2^e, the bits of 2/pi before bit e-1 only add multiples of 4 to x*2/pi,
+ * so m is multiplied with the 256 bits after that in integer arithmetic. Returns r = |x| - q*pi/2 with |r| <= pi/4. */
+static inline wasm_dd wasm_math_rem_pio2_large(f64 ax, int* q)
+{
+	u64 u = wasm_math_bits(ax), m = (u & 0x000fffffffffffffULL) | 0x0010000000000000ULL;
+	int e = (int)(u >> 52) - 1075, i0 = (e - 1 > 1 ? e - 1 : 1), s = i0 + 255 - e, h; /* ax*2/pi mod 4 = m*W / 2^s */
+	u32 w[8], p[10] = { 0 };
+	for (int k = 0; k != 4; k++) { u64 bits = wasm_math_2_pi_bits(i0 + 64 * (3 - k)); w[2 * k] = (u32)bits; w[2 * k + 1] = (u32)(bits >> 32); }
+	for (int j = 0; j != 2; j++)
+	{
+		u64 mj = (j ? m >> 32 : m & 0xffffffffULL), carry = 0;
+		for (int k = 0; k != 8; k++) { carry += p[j + k] + mj * w[k]; p[j + k] = (u32)carry; carry >>= 32; }
+		p[j + 8] = (u32)carry;
+	}
+	*q = (int)(wasm_math_limbs_bits(p, 10, s) & 3);
+
+	/* A fraction of 1/2 or more is taken as the negative distance to the next quadrant */
+	bool neg = ((p[(s - 1) >> 5] >> ((s - 1) & 31)) & 1) != 0;
+	if (neg)
+	{
+		(*q)++;
+		u64 carry = 1;
+		for (int k = 0; k != 10; k++) { carry += (u32)~p[k]; p[k] = (u32)carry; carry >>= 32; }
+	}
+	for (h = s - 1; h >= 0 && !((p[h >> 5] >> (h & 31)) & 1); h--) {}
+	if (h < 0) return wasm_dd_make(0.0, 0.0);
+
+	/* The 128 bits from the highest set one make the fraction as a double-double, times pi/2 */
+	u64 hi = wasm_math_limbs_bits(p, 10, h - 63), lo = wasm_math_limbs_bits(p, 10, h - 127);
+	wasm_dd f = wasm_dd_fast_two_sum((f64)(hi >> 11) * 2048.0, (f64)(hi & 0x7ff) + (f64)lo * 5.421010862427522e-20);
+	wasm_dd r = wasm_dd_mul(f, wasm_math_pi_2);
+	r.hi = Z_envZ_ldexpZ_ddi(r.hi, h - 63 - s);
+	r.lo = Z_envZ_ldexpZ_ddi(r.lo, h - 63 - s);
+	return (neg ? wasm_dd_neg(r) : r);
+}
+
+/* sin or cos of x, arguments of |x| < 2^20 (all the encoder uses) are reduced with pi/2 split into parts, larger ones with Payne-Hanek */
+static inline f64 wasm_math_sincos(f64 x, bool is_cos)
+{
+	static const f64 pio2_1 = 1.5707963267341256, pio2_2 = 6.077100506303966e-11, pio2_3 = 2.0222662487111665e-21, pio2_4 = 8.4784276603689e-32, pio2_5 = 7.398504768267704e-49; /* pi/2 split into 33+33+33+53+53 bits */
+	f64 ax = (x < 0 ? -x : x), res;
+	if (ax < 7.450580596923828e-09) return (is_cos ? 1.0 : x); /* sin(x) = x - x^3/6 rounds to x and cos(x) = 1 - x^2/2 rounds to 1 */
+
+	/* r = |x| - q*pi/2 with |r| <= pi/4 */
+	int iq;
+	wasm_dd r;
+	if (ax < 1048576.0)
+	{
+		f64 q = wasm_math_round_int(ax * 0.6366197723675814);
+		r = wasm_dd_two_sum(ax - q * pio2_1, -(q * pio2_2)); /* the products with the 33 bit parts are exact */
+		r = wasm_dd_add_d(r, -(q * pio2_3));
+		r = wasm_dd_add(r, wasm_dd_neg(wasm_dd_two_prod(q, pio2_4)));
+		r = wasm_dd_add_d(r, -(q * pio2_5));
+		iq = (int)q;
+	}
+	else if (!(ax < HUGE_VAL)) return x - x; /* NaN for infinity and NaN */
+	else r = wasm_math_rem_pio2_large(ax, &iq);
+	int quadrant = (iq + (is_cos ? 1 : 0)) & 3; /* cos(x) = sin(x + pi/2) */
+	bool neg_r = (r.hi < 0);
+	if (neg_r) r = wasm_dd_neg(r);
+
+	/* sin(c + d) = sin(c)cos(d) + cos(c)sin(d) and cos(c + d) = cos(c)cos(d) - sin(c)sin(d) with c = j/64 closest to r */
+	int j = (int)wasm_math_round_int(r.hi * 64.0);
+	wasm_dd d = wasm_dd_make(r.hi - j * 0.015625, r.lo), sc = wasm_math_sin_tbl[j], cc = wasm_math_cos_tbl[j], v; /* r.hi - c is exact */
+	f64 z = d.hi * d.hi;
+	f64 ds = -d.hi * z * (0.16666666666666666 - z * (0.008333333333333333 - z * (0.0001984126984126984 - z * 2.7557319223985893e-06))); /* sin(d) - d */
+	f64 dc = -z * (0.5 - z * (0.041666666666666664 - z * (0.001388888888888889 - z * 2.48015873015873e-05))) - d.hi * d.lo; /* cos(d) - 1 */
+	if (quadrant & 1) v = wasm_dd_add_d(wasm_dd_add(cc, wasm_dd_neg(wasm_dd_mul_d(sc, d.hi))), cc.hi * dc - sc.hi * ds - sc.hi * d.lo);
+	else v = wasm_dd_add_d(wasm_dd_add(sc, wasm_dd_mul_d(cc, d.hi)), cc.hi * d.lo + sc.hi * dc + cc.hi * ds);
+	if (!wasm_math_round_check(v, &res))
+	{
+		d = wasm_dd_add_d(r, -(j * 0.015625));
+		wasm_dd d2 = wasm_dd_mul(d, d), sind = wasm_dd_mul(d, wasm_dd_poly(d2, wasm_math_sin_coef_tbl, 9)), cosd = wasm_dd_poly(d2, wasm_math_cos_coef_tbl, 9);
+		if (quadrant & 1) v = wasm_dd_add(wasm_dd_mul(cc, cosd), wasm_dd_neg(wasm_dd_mul(sc, sind)));
+		else v = wasm_dd_add(wasm_dd_mul(sc, cosd), wasm_dd_mul(cc, sind));
+		res = v.hi + v.lo;
+	}
+	if (neg_r && !(quadrant & 1)) res = -res; /* sin(-r) = -sin(r), cos(-r) = cos(r) */
+	if (quadrant & 2) res = -res;
+	return ((!is_cos && x < 0) ? -res : res);
+}
+
+/* The encoder calls these with the same few thousand arguments over and over while setting up its tables so recent results are kept */
+struct wasm_math_cache { u64 key[1024]; f64 res[1024]; };
+static wasm_math_cache wasm_math_sin_cache, wasm_math_cos_cache, wasm_math_exp_cache, wasm_math_log_cache, wasm_math_atan_cache;
+static inline f64 wasm_math_cached(wasm_math_cache* c, f64 (*fn)(f64), f64 x)
+{
+	if (x != x) return fn(x); /* NaN bypasses the cache, so key can't wrap around to 0 */
+	u64 u = wasm_math_bits(x), key = u + 1; /* 0 marks an empty entry */
+	u32 h = (u32)((u * 0x9E3779B97F4A7C15ULL) >> 54);
+	if (c->key[h] != key) { c->key[h] = key; c->res[h] = fn(x); }
+	return c->res[h];
+}
+static inline f64 wasm_math_sin(f64 x) { return wasm_math_sincos(x, false); }
+static inline f64 wasm_math_cos(f64 x) { return wasm_math_sincos(x, true); }
+static inline f64 Z_envZ_sinZ_dd(f64 x) { return wasm_math_cached(&wasm_math_sin_cache, wasm_math_sin, x); }
+static inline f64 Z_envZ_cosZ_dd(f64 x) { return wasm_math_cached(&wasm_math_cos_cache, wasm_math_cos, x); }
+static inline f64 Z_envZ_expZ_dd(f64 x) { return wasm_math_cached(&wasm_math_exp_cache, wasm_math_exp, x); }
+static inline f64 Z_envZ_logZ_dd(f64 x) { return wasm_math_cached(&wasm_math_log_cache, wasm_math_log, x); }
+static inline f64 Z_envZ_atanZ_dd(f64 x) { return wasm_math_cached(&wasm_math_atan_cache, wasm_math_atan, x); }
+#endif
 
 /* TRAP(x) as written in the generated .wasm.cpp file isn't C++ conformant (error in GCC/clang, accepted in MSVC).
  * But the math function usage to directly use sin/cos/etc. isn't C conformant. */
@@ -261,16 +726,24 @@ static inline uint32_t Z_envZ_sbrkZ_ii(uint32_t increment)
 	return oldSize;
 }
 
+/* Peak memory use of an encode in 64 KB pages by quality level 0 to 10 (measured with one page of headroom).
+ * The memory is allocated at that size up front so sbrk doesn't need to reallocate it in the middle of a track. */
+static const uint8_t wasm_rt_encode_pages[11] = { 20, 20, 21, 21, 21, 21, 20, 20, 20, 20, 20 };
+static uint32_t wasm_rt_reserve_pages;
+
 static inline void wasm_rt_allocate_memory(wasm_rt_memory_t* mem, uint32_t initial_pages, uint32_t max_pages)
 {
-	mem->size = initial_pages * 65536;
-	if (mem->data == NULL)
+	// Memory past the heap end of the previous encode has never been written to so only the part before it needs to be cleared
+	uint32_t dirtySize = (mem->data ? mem->size : 0), pages = (initial_pages > wasm_rt_reserve_pages ? initial_pages : wasm_rt_reserve_pages);
+	if (pages > mem->pages)
 	{
-		mem->max_pages = max_pages;
-		mem->pages = initial_pages + 12; // add extra pages needed by vorbis encoding to avoid reallocation in sbrk
-		mem->data = w2c_mem_data = (uint8_t*)malloc(mem->pages * 65536);
+		mem->data = w2c_mem_data = (uint8_t*)realloc(mem->data, pages * 65536);
+		memset(w2c_mem_data + mem->pages * 65536, 0, (pages - mem->pages) * 65536);
+		mem->pages = pages;
 	}
-	memset(w2c_mem_data, 0, mem->pages * 65536);
+	memset(w2c_mem_data, 0, dirtySize);
+	mem->size = initial_pages * 65536;
+	mem->max_pages = max_pages;
 }
 
 static inline uint32_t wasm_rt_register_func_type(uint32_t params, uint32_t results, ...)
@@ -299,6 +772,81 @@ static inline void Z_envZ_EncodeVorbisOutputZ_vii(uint32_t ptrData, uint32_t len
 	_cur_outpt(w2c_mem_data + ptrData, len, _cur_user_data);
 }
 
+/* The state of a running encode is the linear memory up to the heap end plus the globals and locals which w2c_EncodeVorbis lists in
+ * W2C_ENCODEVORBIS_STATE. They are saved at the top of its main loop where the wasm value stack is empty and no other function is running. */
+#define WASM_RT_STATE_MAGIC 0x31535645 /* EVS1 */
+#define WASM_RT_STATE_SIZE(v) + (uint32_t)sizeof(v)
+#define WASM_RT_STATE_SAVE(v) memcpy(w2c_state, &(v), sizeof(v)); w2c_state += sizeof(v);
+#define WASM_RT_STATE_LOAD(v) memcpy(&(v), w2c_state, sizeof(v)); w2c_state += sizeof(v);
+static fnEncodeVorbisCheckpoint wasm_rt_checkpoint_fn;
+static void* wasm_rt_checkpoint_user_data;
+static uint8_t* wasm_rt_state_buf;
+static uint32_t wasm_rt_state_len, wasm_rt_state_cap;
+static const uint8_t* wasm_rt_resume_state;
+static uint32_t wasm_rt_resume_len;
+static int wasm_rt_resumed;
+
+static inline uint8_t* wasm_rt_checkpoint_begin(uint32_t varsLen)
+{
+	uint32_t memSize = WASM_RT_ADD_PREFIX(Z_memory)->size, hdr[3] = { WASM_RT_STATE_MAGIC, varsLen, memSize };
+	wasm_rt_state_len = 12 + varsLen + memSize;
+	if (wasm_rt_state_len > wasm_rt_state_cap) wasm_rt_state_buf = (uint8_t*)realloc(wasm_rt_state_buf, (wasm_rt_state_cap = wasm_rt_state_len));
+	memcpy(wasm_rt_state_buf, hdr, 12);
+	memcpy(wasm_rt_state_buf + 12 + varsLen, w2c_mem_data, memSize);
+	return wasm_rt_state_buf + 12; // the globals and locals get written here
+}
+
+static inline void wasm_rt_checkpoint_end(void)
+{
+	fnEncodeVorbisCheckpoint checkpoint = wasm_rt_checkpoint_fn;
+	wasm_rt_checkpoint_fn = NULL;
+	checkpoint(wasm_rt_state_buf, wasm_rt_state_len, wasm_rt_checkpoint_user_data);
+}
+
+/* Restores the linear memory and returns the globals and locals to load, memory past the heap end was never written so it is zero in both cases */
+static inline const uint8_t* wasm_rt_resume_begin(uint32_t varsLen)
+{
+	const uint8_t* state = wasm_rt_resume_state;
+	wasm_rt_memory_t* mem = WASM_RT_ADD_PREFIX(Z_memory);
+	uint32_t hdr[3];
+	wasm_rt_resume_state = NULL;
+	if (wasm_rt_resume_len < 12) return NULL;
+	memcpy(hdr, state, 12);
+	if (hdr[0] != WASM_RT_STATE_MAGIC || hdr[1] != varsLen || wasm_rt_resume_len != 12 + varsLen + hdr[2] || hdr[2] < mem->size) return NULL;
+	uint32_t pages = (hdr[2] + 65535) / 65536;
+	if (pages > mem->pages)
+	{
+		mem->data = w2c_mem_data = (uint8_t*)realloc(mem->data, pages * 65536);
+		memset(w2c_mem_data + mem->pages * 65536, 0, (pages - mem->pages) * 65536);
+		mem->pages = pages;
+	}
+	memcpy(w2c_mem_data, state + 12 + varsLen, hdr[2]);
+	mem->size = hdr[2];
+	wasm_rt_resumed = 1;
+	return state + 12;
+}
+
+void WasmEncodeVorbisCheckpoint(fnEncodeVorbisCheckpoint checkpoint, void* user_data)
+{
+	wasm_rt_checkpoint_fn = checkpoint;
+	wasm_rt_checkpoint_user_data = user_data;
+}
+
+int WasmResumeVorbis(int quality, const void* state, uint32_t len, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data)
+{
+	if (!state) return 0;
+	wasm_rt_resume_state = (const uint8_t*)state;
+	wasm_rt_resume_len = len;
+	wasm_rt_resumed = 0;
+	WasmEncodeVorbis(quality, feed, outpt, user_data);
+	return wasm_rt_resumed;
+}
+
+uint32_t WasmEncodeVorbisMemoryUsed(void)
+{
+	return WASM_RT_ADD_PREFIX(Z_memory)->size;
+}
+
 void WasmEncodeVorbis(int quality, fnEncodeVorbisFeedSamples feed, fnEncodeVorbisOutput outpt, void* user_data)
 {
 	int olddir = fegetround();
@@ -306,7 +854,9 @@ void WasmEncodeVorbis(int quality, fnEncodeVorbisFeedSamples feed, fnEncodeVorbi
 	_cur_feed = feed;
 	_cur_outpt = outpt;
 	_cur_user_data = user_data;
+	wasm_rt_checkpoint_fn = NULL;
 	wasm_rt_func_counter = 0;
+	wasm_rt_reserve_pages = wasm_rt_encode_pages[quality < 0 ? 0 : quality > 10 ? 10 : quality];
 	WASM_RT_ADD_PREFIX(init)();
 	w2c___wasm_call_ctors();
 	w2c_EncodeVorbis((u32)quality);
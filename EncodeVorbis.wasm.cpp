@@ -26315,6 +26315,17 @@ static void w2c_f89(u32 w2c_p0, f64 w2c_p1, u32 w2c_p2, u32 w2c_p3, u32 w2c_p4,
   FUNC_EPILOGUE;
 }
 
+/* Everything w2c_EncodeVorbis keeps outside of the linear memory at the top of its main loop (w2c_L395), used for checkpoints */
+#define W2C_ENCODEVORBIS_STATE(X) \
+  X(w2c_g0) X(w2c_p0) X(w2c_l1) X(w2c_l2) X(w2c_l3) X(w2c_l4) X(w2c_l5) X(w2c_l6) X(w2c_l7) X(w2c_l8) X(w2c_l9) X(w2c_l10) \
+  X(w2c_l11) X(w2c_l12) X(w2c_l13) X(w2c_l14) X(w2c_l15) X(w2c_l16) X(w2c_l17) X(w2c_l18) X(w2c_l19) X(w2c_l20) X(w2c_l21) X(w2c_l22) \
+  X(w2c_l23) X(w2c_l24) X(w2c_l25) X(w2c_l26) X(w2c_l27) X(w2c_l28) X(w2c_l29) X(w2c_l30) X(w2c_l31) X(w2c_l32) X(w2c_l33) X(w2c_l34) \
+  X(w2c_l35) X(w2c_l36) X(w2c_l37) X(w2c_l38) X(w2c_l39) X(w2c_l40) X(w2c_l41) X(w2c_l42) X(w2c_l43) X(w2c_l44) X(w2c_l45) X(w2c_l46) \
+  X(w2c_l47) X(w2c_l48) X(w2c_l49) X(w2c_l50) X(w2c_l51) X(w2c_l52) X(w2c_l53) X(w2c_l54) X(w2c_l55) X(w2c_l56) X(w2c_l57) X(w2c_l58) \
+  X(w2c_l59) X(w2c_l60) X(w2c_l61) X(w2c_l62) X(w2c_l63) X(w2c_l64) X(w2c_l65) X(w2c_l66) X(w2c_l67) X(w2c_l68) X(w2c_l69) X(w2c_l70) \
+  X(w2c_l71) X(w2c_l72) X(w2c_l73) X(w2c_l74) X(w2c_l75) X(w2c_l76) X(w2c_l77) X(w2c_l78) X(w2c_l79) X(w2c_l80) X(w2c_l81) X(w2c_l82) \
+  X(w2c_l83) X(w2c_l84)
+
 static void w2c_EncodeVorbis(u32 w2c_p0) {
   u32 w2c_l1 = 0, w2c_l2 = 0, w2c_l3 = 0, w2c_l4 = 0, w2c_l5 = 0, w2c_l6 = 0, w2c_l7 = 0, w2c_l8 = 0, 
       w2c_l9 = 0, w2c_l10 = 0, w2c_l11 = 0, w2c_l12 = 0, w2c_l13 = 0, w2c_l14 = 0, w2c_l15 = 0, w2c_l16 = 0, 
@@ -26334,6 +26345,12 @@ static void w2c_EncodeVorbis(u32 w2c_p0) {
   u64 w2c_j1, w2c_j2, w2c_j3;
   f32 w2c_f0, w2c_f1, w2c_f2, w2c_f3, w2c_f4, w2c_f5, w2c_f6;
   f64 w2c_d0, w2c_d1, w2c_d2, w2c_d3, w2c_d4, w2c_d5, w2c_d6, w2c_d7;
+  if (wasm_rt_resume_state) {
+    const u8* w2c_state = wasm_rt_resume_begin(0 W2C_ENCODEVORBIS_STATE(WASM_RT_STATE_SIZE));
+    if (!w2c_state) {FUNC_EPILOGUE; return;}
+    W2C_ENCODEVORBIS_STATE(WASM_RT_STATE_LOAD)
+    goto w2c_L395;
+  }
   w2c_i0 = w2c_g0;
   w2c_i1 = 752u;
   w2c_i0 -= w2c_i1;
@@ -34246,6 +34263,11 @@ static void w2c_EncodeVorbis(u32 w2c_p0) {
         if (w2c_i0) {goto w2c_L394;}
     }
     w2c_L395: 
+      if (wasm_rt_checkpoint_fn) {
+        u8* w2c_state = wasm_rt_checkpoint_begin(0 W2C_ENCODEVORBIS_STATE(WASM_RT_STATE_SIZE));
+        W2C_ENCODEVORBIS_STATE(WASM_RT_STATE_SAVE)
+        wasm_rt_checkpoint_end();
+      }
       w2c_i0 = w2c_l22;
       w2c_i1 = 184u;
       w2c_i0 += w2c_i1;